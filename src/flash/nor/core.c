@@ -27,6 +27,7 @@
 #include <flash/nor/core.h>
 #include <flash/nor/imp.h>
 #include <target/image.h>
+#include <jtag/adapter_stats.h>
 
 /**
  * @file
@@ -35,6 +36,9 @@
  * primarily support access from Tcl scripts or from GDB.
  */
 
+/* largest part of an image flash_write_unlock_verify() buffers at once */
+#define FLASH_WRITE_CHUNK_SIZE	(64 * 1024)
+
 static struct flash_bank *flash_banks;
 
 int flash_driver_erase(struct flash_bank *bank, unsigned int first,
@@ -42,7 +46,10 @@ int flash_driver_erase(struct flash_bank *bank, unsigned int first,
 {
 	int retval;
 
+	enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_FLASH);
 	retval = bank->driver->erase(bank, first, last);
+	adapter_stats_leave(op);
+	target_memory_changed(bank->target);
 	if (retval != ERROR_OK)
 		LOG_ERROR("failed erasing sectors %u to %u", first, last);
 
@@ -98,7 +105,10 @@ int flash_driver_write(struct flash_bank *bank,
 {
 	int retval;
 
+	enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_FLASH);
 	retval = bank->driver->write(bank, buffer, offset, count);
+	adapter_stats_leave(op);
+	target_memory_changed(bank->target);
 	if (retval != ERROR_OK) {
 		LOG_ERROR(
 			"error writing to flash at address " TARGET_ADDR_FMT
@@ -226,6 +236,8 @@ void default_flash_free_driver_priv(struct flash_bank *bank)
 
 void flash_free_all_banks(void)
 {
+	flash_sector_cache_close();
+
 	struct flash_bank *bank = flash_banks;
 	while (bank) {
 		struct flash_bank *next = bank->next;
@@ -411,9 +423,13 @@ int default_flash_blank_check(struct flash_bank *bank)
 
 	bool fast_check = true;
 	for (unsigned int i = 0; i < bank->num_sectors; ) {
-		retval = target_blank_check_memory(target,
-				block_array + i, bank->num_sectors - i,
-				bank->erased_value);
+		if (bank->driver->blank_check_memory)
+			retval = bank->driver->blank_check_memory(bank,
+					block_array + i, bank->num_sectors - i);
+		else
+			retval = target_blank_check_memory(target,
+					block_array + i, bank->num_sectors - i,
+					bank->erased_value);
 		if (retval < 1) {
 			/* Run slow fallback if the first run gives no result
 			 * otherwise use possibly incomplete results */
@@ -702,6 +718,36 @@ target_addr_t flash_write_align_end(struct flash_bank *bank, target_addr_t addr)
 	return addr | (bank->write_end_alignment - 1);
 }
 
+/**
+ * Size of the next chunk of a write run that is buffered: up to
+ * FLASH_WRITE_CHUNK_SIZE bytes ending on a sector boundary, or a single
+ * sector if that is larger. Chunks thus look to the driver like the runs
+ * of an image made of several sections.
+ */
+static uint32_t flash_write_chunk_size(struct flash_bank *bank,
+		target_addr_t address, uint32_t size)
+{
+	if (size <= FLASH_WRITE_CHUNK_SIZE)
+		return size;
+
+	uint32_t offset = address - bank->base;
+	uint32_t end = 0;
+
+	for (unsigned int sector = 0; sector < bank->num_sectors; sector++) {
+		uint32_t sector_end = bank->sectors[sector].offset + bank->sectors[sector].size;
+
+		if (sector_end <= offset)
+			continue;
+		if (end && sector_end - offset > FLASH_WRITE_CHUNK_SIZE)
+			break;
+		end = sector_end;
+	}
+
+	if (!end || end - offset >= size)
+		return size;
+	return end - offset;
+}
+
 /**
  * Check if gap between sections is bigger than minimum required to discontinue flash write
  */
@@ -734,8 +780,326 @@ static bool flash_write_check_gap(struct flash_bank *bank,
 }
 
 
+/**
+ * Compare sectors first..last of a write run with the flash contents, using
+ * CRCs on both sides.
+ */
+static int flash_incremental_range_differs(struct flash_bank *bank, const uint8_t *buffer,
+	target_addr_t run_address, unsigned int first, unsigned int last, bool *differs)
+{
+	target_addr_t start = bank->base + bank->sectors[first].offset;
+	target_addr_t end = bank->base + bank->sectors[last].offset + bank->sectors[last].size;
+	uint32_t image_crc, target_crc;
+	int retval;
+
+	retval = image_calculate_checksum(buffer + (start - run_address), end - start, &image_crc);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_checksum_memory(bank->target, start, end - start, &target_crc);
+	if (retval != ERROR_OK)
+		return retval;
+
+	*differs = image_crc != target_crc;
+	return ERROR_OK;
+}
+
+/**
+ * Find the sectors first..last of a write run that differ from the flash
+ * contents, given that the range as a whole does. The range is split in half
+ * until single sectors remain, which are then marked in @a dirty. When only
+ * a few sectors changed this needs far fewer checksum runs than checking
+ * every sector on its own.
+ *
+ * When many sectors changed, the bisection could cost up to two checksum
+ * runs per sector. @a budget holds the number of runs still allowed; once it
+ * is used up, ranges that differ are marked as a whole instead of being
+ * split further.
+ */
+static int flash_incremental_diff(struct flash_bank *bank, const uint8_t *buffer,
+	target_addr_t run_address, unsigned int first, unsigned int last,
+	unsigned int *budget, bool *dirty)
+{
+	bool differs[2];
+	int retval;
+
+	if (first == last) {
+		dirty[first] = true;
+		return ERROR_OK;
+	}
+
+	if (*budget < 2) {
+		LOG_DEBUG("too many sectors differ, rewriting sectors %u to %u", first, last);
+		for (unsigned int i = first; i <= last; i++)
+			dirty[i] = true;
+		return ERROR_OK;
+	}
+	*budget -= 2;
+
+	unsigned int mid = first + (last - first) / 2;
+	retval = flash_incremental_range_differs(bank, buffer, run_address, first, mid, &differs[0]);
+	if (retval != ERROR_OK)
+		return retval;
+	retval = flash_incremental_range_differs(bank, buffer, run_address, mid + 1, last, &differs[1]);
+	if (retval != ERROR_OK)
+		return retval;
+
+	if (differs[0]) {
+		retval = flash_incremental_diff(bank, buffer, run_address, first, mid, budget, dirty);
+		if (retval != ERROR_OK)
+			return retval;
+	}
+	if (differs[1])
+		return flash_incremental_diff(bank, buffer, run_address, mid + 1, last, budget, dirty);
+	return ERROR_OK;
+}
+
+/**
+ * Like flash_incremental_diff(), but with the sector CRCs of the current
+ * bank contents known from the sector cache, so that all sectors are
+ * compared on the host.
+ */
+static int flash_sector_cache_diff(struct flash_bank *bank, const uint8_t *buffer,
+	target_addr_t run_address, unsigned int first, unsigned int last,
+	const uint32_t *cached, bool *dirty)
+{
+	int retval;
+
+	for (unsigned int i = first; i <= last; i++) {
+		target_addr_t start = bank->base + bank->sectors[i].offset;
+		uint32_t size = bank->sectors[i].size;
+		uint32_t image_crc;
+
+		retval = image_calculate_checksum(buffer + (start - run_address), size, &image_crc);
+		if (retval != ERROR_OK)
+			return retval;
+		if (image_crc != cached[i])
+			dirty[i] = true;
+	}
+
+	return ERROR_OK;
+}
+
+/**
+ * Record the bank contents in the sector cache after a write run. Sector
+ * CRCs come from the image where the run covered the whole sector, from the
+ * previous cache entry where the sector was left alone, and from reading
+ * the flash back otherwise.
+ *
+ * The sectors that were reprogrammed are checksummed on the target first,
+ * one batch of consecutive sectors at a time; if a write silently failed,
+ * nothing is stored, so later writes don't skip sectors that are wrong.
+ */
+static int flash_sector_cache_update(struct flash_bank *bank, const uint8_t *buffer,
+	target_addr_t run_address, uint32_t run_size, const uint32_t *cached, const bool *dirty)
+{
+	uint32_t *crcs;
+	uint8_t *sector_buffer = NULL;
+	uint32_t sector_buffer_size = 0;
+	uint32_t bank_crc;
+	int retval = ERROR_OK;
+
+	for (unsigned int i = 0; i < bank->num_sectors; i++) {
+		if (!dirty[i])
+			continue;
+
+		unsigned int batch_last = i;
+		while (batch_last + 1 < bank->num_sectors && dirty[batch_last + 1])
+			batch_last++;
+
+		target_addr_t start = bank->base + bank->sectors[i].offset;
+		uint32_t size = bank->sectors[batch_last].offset + bank->sectors[batch_last].size
+			- bank->sectors[i].offset;
+		uint32_t image_crc, target_crc;
+
+		retval = image_calculate_checksum(buffer + (start - run_address), size, &image_crc);
+		if (retval == ERROR_OK)
+			retval = target_checksum_memory(bank->target, start, size, &target_crc);
+		if (retval != ERROR_OK)
+			return retval;
+		if (image_crc != target_crc) {
+			LOG_WARNING("flash at " TARGET_ADDR_FMT " doesn't match the image after writing",
+					start);
+			return ERROR_FLASH_OPERATION_FAILED;
+		}
+		i = batch_last;
+	}
+
+	crcs = malloc(bank->num_sectors * sizeof(*crcs));
+	if (!crcs) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	for (unsigned int i = 0; retval == ERROR_OK && i < bank->num_sectors; i++) {
+		target_addr_t start = bank->base + bank->sectors[i].offset;
+		uint32_t size = bank->sectors[i].size;
+
+		if (start >= run_address && start + size <= run_address + run_size) {
+			retval = image_calculate_checksum(buffer + (start - run_address), size, &crcs[i]);
+			continue;
+		}
+
+		if (cached && !dirty[i]) {
+			crcs[i] = cached[i];
+			continue;
+		}
+
+		if (size > sector_buffer_size) {
+			uint8_t *p = realloc(sector_buffer, size);
+			if (!p) {
+				LOG_ERROR("Out of memory");
+				retval = ERROR_FAIL;
+				break;
+			}
+			sector_buffer = p;
+			sector_buffer_size = size;
+		}
+		retval = target_read_buffer(bank->target, start, size, sector_buffer);
+		if (retval == ERROR_OK)
+			retval = image_calculate_checksum(sector_buffer, size, &crcs[i]);
+	}
+
+	if (retval == ERROR_OK)
+		retval = target_checksum_memory(bank->target, bank->base, bank->size, &bank_crc);
+	if (retval == ERROR_OK)
+		retval = flash_sector_cache_store(bank, bank_crc, crcs);
+
+	free(sector_buffer);
+	free(crcs);
+	return retval;
+}
+
+/**
+ * Erase and program only those sectors of a write run whose contents differ
+ * from @a buffer. Consecutive differing sectors are handled as one batch.
+ * With a sector cache the initial comparison is done on the host whenever
+ * the bank contents are found in the cache.
+ *
+ * A run that does not start or end on a sector boundary is first extended
+ * to whole sectors with the current flash contents, so erasing a sector
+ * never loses the bytes around the run.
+ */
+static int flash_write_incremental(struct flash_bank *bank, const uint8_t *buffer,
+	target_addr_t run_address, uint32_t run_size)
+{
+	uint32_t offset = run_address - bank->base;
+	unsigned int first = 0, last;
+	uint8_t *padded = NULL;
+	int retval;
+
+	while (first < bank->num_sectors &&
+			bank->sectors[first].offset + bank->sectors[first].size <= offset)
+		first++;
+	for (last = first; last + 1 < bank->num_sectors; last++) {
+		if (bank->sectors[last].offset + bank->sectors[last].size >= offset + run_size)
+			break;
+	}
+	if (first >= bank->num_sectors)
+		return ERROR_FLASH_DST_OUT_OF_BANK;
+
+	target_addr_t sector_start = bank->base + bank->sectors[first].offset;
+	target_addr_t sector_end = bank->base + bank->sectors[last].offset + bank->sectors[last].size;
+	if (run_address + run_size > sector_end)
+		return ERROR_FLASH_DST_OUT_OF_BANK;
+	if (sector_start != run_address || sector_end != run_address + run_size) {
+		uint32_t head = run_address - sector_start;
+		uint32_t tail = sector_end - (run_address + run_size);
+
+		LOG_INFO("Padding write run at " TARGET_ADDR_FMT " to whole sectors, keeping "
+				"%" PRIu32 " bytes before and %" PRIu32 " bytes after it",
+				run_address, head, tail);
+
+		padded = malloc(sector_end - sector_start);
+		if (!padded) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		retval = ERROR_OK;
+		if (head)
+			retval = target_read_buffer(bank->target, sector_start, head, padded);
+		if (retval == ERROR_OK && tail)
+			retval = target_read_buffer(bank->target, run_address + run_size, tail,
+					padded + head + run_size);
+		if (retval != ERROR_OK) {
+			free(padded);
+			return retval;
+		}
+		memcpy(padded + head, buffer, run_size);
+
+		buffer = padded;
+		run_address = sector_start;
+		run_size = sector_end - sector_start;
+	}
+
+	bool *dirty = calloc(bank->num_sectors, sizeof(*dirty));
+	if (!dirty) {
+		LOG_ERROR("Out of memory");
+		free(padded);
+		return ERROR_FAIL;
+	}
+
+	const uint32_t *cached = NULL;
+	if (flash_sector_cache_enabled()) {
+		uint32_t bank_crc;
+		if (target_checksum_memory(bank->target, bank->base, bank->size, &bank_crc) == ERROR_OK)
+			cached = flash_sector_cache_lookup(bank, bank_crc);
+		if (cached)
+			LOG_DEBUG("contents of flash bank %s found in sector cache", bank->name);
+	}
+
+	if (cached) {
+		retval = flash_sector_cache_diff(bank, buffer, run_address, first, last, cached, dirty);
+	} else {
+		/* never more checksum runs than checking each sector on its own */
+		unsigned int budget = last - first;
+		bool differs;
+		retval = flash_incremental_range_differs(bank, buffer, run_address, first, last,
+				&differs);
+		if (retval == ERROR_OK && differs)
+			retval = flash_incremental_diff(bank, buffer, run_address, first, last,
+					&budget, dirty);
+	}
+
+	unsigned int changed = 0;
+	for (unsigned int i = first; retval == ERROR_OK && i <= last; i++) {
+		if (!dirty[i])
+			continue;
+
+		unsigned int batch_last = i;
+		while (batch_last < last && dirty[batch_last + 1])
+			batch_last++;
+		changed += batch_last - i + 1;
+
+		target_addr_t start = bank->base + bank->sectors[i].offset;
+		target_addr_t end = bank->base + bank->sectors[batch_last].offset
+			+ bank->sectors[batch_last].size;
+
+		retval = flash_driver_erase(bank, i, batch_last);
+		if (retval == ERROR_OK)
+			retval = flash_driver_write(bank, buffer + (start - run_address),
+					start - bank->base, end - start);
+		i = batch_last;
+	}
+
+	if (retval == ERROR_OK)
+		LOG_INFO("%u of %u sectors at " TARGET_ADDR_FMT " differ and were reprogrammed",
+			changed, last - first + 1, run_address);
+
+	if (retval == ERROR_OK && flash_sector_cache_enabled()) {
+		if (flash_sector_cache_update(bank, buffer, run_address, run_size,
+				cached, dirty) != ERROR_OK)
+			LOG_WARNING("couldn't update flash sector cache");
+	}
+
+	free(dirty);
+	free(padded);
+	return retval;
+}
+
 int flash_write_unlock_verify(struct target *target, struct image *image,
-	uint32_t *written, bool erase, bool unlock, bool write, bool verify)
+	uint32_t *written, bool erase, bool unlock, bool write, bool verify,
+	bool incremental)
 {
 	int retval = ERROR_OK;
 
@@ -750,6 +1114,10 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 	if (written)
 		*written = 0;
 
+	/* with a sector cache, sectors already holding the image are left alone */
+	if (erase && write && flash_sector_cache_enabled())
+		incremental = true;
+
 	if (erase) {
 		/* assume all sectors need erasing - stops any problems
 		 * when flash_write is called multiple times */
@@ -901,55 +1269,22 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 			run_size += delta;
 		}
 
-		/* allocate buffer */
-		buffer = malloc(run_size);
-		if (!buffer) {
-			LOG_ERROR("Out of memory for flash bank buffer");
-			retval = ERROR_FAIL;
-			goto done;
-		}
-
-		if (padding_at_start)
-			memset(buffer, c->default_padded_value, padding_at_start);
-
-		buffer_idx = padding_at_start;
-
-		/* read sections to the buffer */
-		while (buffer_idx < run_size) {
-			size_t size_read;
-
-			size_read = run_size - buffer_idx;
-			if (size_read > sections[section]->size - section_offset)
-				size_read = sections[section]->size - section_offset;
-
-			/* KLUDGE!
-			 *
-			 * #¤%#"%¤% we have to figure out the section # from the sorted
-			 * list of pointers to sections to invoke image_read_section()...
-			 */
-			intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
-			int t_section_num = diff / sizeof(struct imagesection);
-
-			LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
-					"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
-				section, t_section_num, section_offset,
-				buffer_idx, size_read);
-			retval = image_read_section(image, t_section_num, section_offset,
-					size_read, buffer + buffer_idx, &size_read);
-			if (retval != ERROR_OK || size_read == 0) {
-				free(buffer);
-				goto done;
-			}
-
-			buffer_idx += size_read;
-			section_offset += size_read;
-
-			/* see if we need to pad the section */
-			if (padding[section]) {
-				memset(buffer + buffer_idx, c->default_padded_value, padding[section]);
-				buffer_idx += padding[section];
-			}
-
+		/* KLUDGE!
+		 *
+		 * #¤%#"%¤% we have to figure out the section # from the sorted
+		 * list of pointers to sections to invoke image_read_section()...
+		 */
+		intptr_t diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+		int t_section_num = diff / sizeof(struct imagesection);
+
+		/* A run made of a single section that needs no padding can be
+		 * written straight from the image if its data is already in memory,
+		 * without copying it into a bounce buffer first. */
+		const uint8_t *data = NULL;
+		if (section_last == section && !padding_at_start && !padding[section]
+				&& image_section_data(image, t_section_num, section_offset,
+						run_size, &data) == ERROR_OK) {
+			section_offset += run_size;
 			if (section_offset >= sections[section]->size) {
 				section++;
 				section_offset = 0;
@@ -961,28 +1296,111 @@ int flash_write_unlock_verify(struct target *target, struct image *image,
 		if (unlock)
 			retval = flash_unlock_address_range(target, run_address, run_size);
 		if (retval == ERROR_OK) {
-			if (erase) {
+			if (erase && !incremental) {
 				/* calculate and erase sectors */
 				retval = flash_erase_address_range(target,
 						true, run_address, run_size);
 			}
 		}
 
-		if (retval == ERROR_OK) {
-			if (write) {
+		/* Otherwise the run is put together from its sections and padding
+		 * and written a chunk at a time, so a large image never needs a
+		 * buffer of its own size. Incremental writes compare the run as a
+		 * whole and get it in one piece. */
+		uint32_t run_offset = 0;
+		uint32_t pad_left = 0;
+		while (retval == ERROR_OK && run_offset < run_size) {
+			uint32_t chunk_size = run_size - run_offset;
+			const uint8_t *chunk;
+
+			buffer = NULL;
+			if (data) {
+				chunk = data + run_offset;
+			} else {
+				if (!(write && incremental))
+					chunk_size = flash_write_chunk_size(c, run_address + run_offset,
+							chunk_size);
+
+				/* allocate buffer */
+				buffer = malloc(chunk_size);
+				if (!buffer) {
+					LOG_ERROR("Out of memory for flash bank buffer");
+					retval = ERROR_FAIL;
+					goto done;
+				}
+				chunk = buffer;
+
+				buffer_idx = 0;
+				if (run_offset < padding_at_start) {
+					buffer_idx = MIN(padding_at_start - run_offset, chunk_size);
+					memset(buffer, c->default_padded_value, buffer_idx);
+				}
+
+				/* read sections to the buffer */
+				while (buffer_idx < chunk_size) {
+					size_t size_read;
+
+					if (pad_left) {
+						size_read = MIN(pad_left, chunk_size - buffer_idx);
+						memset(buffer + buffer_idx, c->default_padded_value, size_read);
+						pad_left -= size_read;
+					} else {
+						size_read = chunk_size - buffer_idx;
+						if (size_read > sections[section]->size - section_offset)
+							size_read = sections[section]->size - section_offset;
+
+						diff = (intptr_t)sections[section] - (intptr_t)image->sections;
+						t_section_num = diff / sizeof(struct imagesection);
+
+						LOG_DEBUG("image_read_section: section = %d, t_section_num = %d, "
+								"section_offset = %"PRIu32", buffer_idx = %"PRIu32", size_read = %zu",
+							section, t_section_num, section_offset,
+							buffer_idx, size_read);
+						retval = image_read_section(image, t_section_num, section_offset,
+								size_read, buffer + buffer_idx, &size_read);
+						if (retval != ERROR_OK || size_read == 0) {
+							free(buffer);
+							goto done;
+						}
+
+						section_offset += size_read;
+
+						/* see if we need to pad the section */
+						if (section_offset >= sections[section]->size)
+							pad_left = padding[section];
+					}
+
+					buffer_idx += size_read;
+
+					if (!pad_left && section_offset >= sections[section]->size) {
+						section++;
+						section_offset = 0;
+					}
+				}
+			}
+
+			target_addr_t chunk_address = run_address + run_offset;
+			if (write && incremental) {
+				/* erase and write only the sectors that changed */
+				retval = flash_write_incremental(c, chunk,
+						chunk_address, chunk_size);
+			} else if (write) {
 				/* write flash sectors */
-				retval = flash_driver_write(c, buffer, run_address - c->base, run_size);
+				retval = flash_driver_write(c, chunk,
+						chunk_address - c->base, chunk_size);
 			}
-		}
 
-		if (retval == ERROR_OK) {
-			if (verify) {
-				/* verify flash sectors */
-				retval = flash_driver_verify(c, buffer, run_address - c->base, run_size);
+			if (retval == ERROR_OK) {
+				if (verify) {
+					/* verify flash sectors */
+					retval = flash_driver_verify(c, chunk,
+							chunk_address - c->base, chunk_size);
+				}
 			}
-		}
 
-		free(buffer);
+			free(buffer);
+			run_offset += chunk_size;
+		}
 
 		if (retval != ERROR_OK) {
 			/* abort operation */
@@ -1003,7 +1421,7 @@ done:
 int flash_write(struct target *target, struct image *image,
 	uint32_t *written, bool erase)
 {
-	return flash_write_unlock_verify(target, image, written, erase, false, true, false);
+	return flash_write_unlock_verify(target, image, written, erase, false, true, false, false);
 }
 
 struct flash_sector *alloc_block_array(uint32_t offset, uint32_t size,
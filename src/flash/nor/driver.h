@@ -23,6 +23,7 @@
 #define OPENOCD_FLASH_NOR_DRIVER_H
 
 struct flash_bank;
+struct target_memory_check_block;
 
 #define __FLASH_BANK_COMMAND(name) \
 		COMMAND_HELPER(name, struct flash_bank *bank)
@@ -189,6 +190,23 @@ struct flash_driver {
 	 */
 	int (*erase_check)(struct flash_bank *bank);
 
+	/**
+	 * Optional routine used by default_flash_blank_check() to check
+	 * an array of blocks on the target, in place of the generic
+	 * target_blank_check_memory(). Lets a driver supply an erase-check
+	 * algorithm tuned for its flash without duplicating the rest of
+	 * the default erase-check logic.
+	 *
+	 * @param bank The bank being checked
+	 * @param blocks Array of blocks; the result of each must be set
+	 *  to 1 if erased, 0 if not
+	 * @param num_blocks Number of entries in @a blocks
+	 * @returns the number of blocks actually checked (which may be
+	 *  fewer than @a num_blocks), or a negative error code.
+	 */
+	int (*blank_check_memory)(struct flash_bank *bank,
+			struct target_memory_check_block *blocks, unsigned int num_blocks);
+
 	/**
 	 * Determine if the specific bank is "protected" or not.
 	 * When called, the driver routine must must perform the
@@ -27,8 +27,11 @@
 #include <helper/time_support.h>
 #include <target/algorithm.h>
 #include <target/arm.h>
+#include <target/armv7m.h>
+#include <target/arm_adi_v5.h>
 
 static int hc32l110_check_flash_completion(struct target *target, unsigned int timeout_ms);
+static int hc32l110_wait_flash_ready(struct target *target, uint32_t status, unsigned int timeout_ms);
 
 #define HC32L110_FLASH_CR			0x40020020 //Flash control register
 #define HC32L110_FLASH_CR_BUSY		(1<<4)     //If this bit is 1, the flash is busy
@@ -47,10 +50,23 @@ static int hc32l110_check_flash_completion(struct target *target, unsigned int t
 #define FLASH_OP_ERASE_CHIP 3
 
 
+struct hc32l110_flash_bank {
+	bool probed;
+};
+
 /* flash bank hc32l110 0 0 0 0 <target#>
  * The hc32l110 devices all have the same flash layout, but varying amounts of it. */
 FLASH_BANK_COMMAND_HANDLER(hc32l110_flash_bank_command)
 {
+	struct hc32l110_flash_bank *hc32l110_info;
+
+	hc32l110_info = calloc(1, sizeof(struct hc32l110_flash_bank));
+	if (!hc32l110_info) {
+		LOG_ERROR("no memory for flash bank info");
+		return ERROR_FAIL;
+	}
+	bank->driver_priv = hc32l110_info;
+
 	bank->base = 0x0000;
 	bank->size = 0x8000; //assume the max of 32K for now
 	return ERROR_OK;
@@ -63,77 +79,130 @@ static void hc32l110_bypass(struct target *target)
 	target_write_u32(target, HC32L110_FLASH_BYPASS, 0xa5a5);
 }
 
-/* Unlock a certain region for erasing/writing */
-static void hc32l110_sunlock(struct target *target, int start_adr, int end_adr)
+/* Unlock the blocks covering [start, end) for erasing/writing. The SLOCK value found
+ * before is returned in saved, so that the locks can be put back afterwards. */
+static int hc32l110_sunlock(struct flash_bank *bank, uint32_t start, uint32_t end,
+		uint32_t *saved)
 {
-	int start_sec=start_adr/SPROT_SEC_SIZE;
-	int end_sec=(end_adr+SPROT_SEC_SIZE-1)/SPROT_SEC_SIZE;
-	int b=0;
-	for (int i=start_sec; i<end_sec; i++) {
-		b|=(1<<i);
-	}
+	struct target *target = bank->target;
+	uint32_t slock;
+
+	int retval = target_read_u32(target, HC32L110_FLASH_SLOCK, saved);
+	if (retval != ERROR_OK)
+		return retval;
+
+	slock = *saved;
+	for (uint32_t i = start / SPROT_SEC_SIZE; i < DIV_ROUND_UP(end, SPROT_SEC_SIZE); i++)
+		slock |= 1 << i;
+
 	hc32l110_bypass(target);
-	target_write_u32(target, HC32L110_FLASH_SLOCK, b);
+	return target_write_u32(target, HC32L110_FLASH_SLOCK, slock);
 }
 
-/* Lock all regions to protect against programming/reading. Note that the locks set here
- * are volatile. */
-static void hc32l110_slock_all(struct target *target)
+/* Put SLOCK back the way it was before hc32l110_sunlock(). At reset (and unless changed
+ * with 'flash protect') all regions are locked. Note that the locks are volatile. */
+static void hc32l110_slock_restore(struct flash_bank *bank, uint32_t saved)
 {
-	hc32l110_bypass(target);
-	target_write_u32(target, HC32L110_FLASH_SLOCK, 0);
+	hc32l110_bypass(bank->target);
+	target_write_u32(bank->target, HC32L110_FLASH_SLOCK, saved);
+}
+
+
+/* Returns the MEM-AP the core is debugged through, or NULL if the target is
+ * not accessed through an ADIv5 DAP we can queue transactions on (e.g. hla). */
+static struct adiv5_ap *hc32l110_get_ap(struct target *target)
+{
+	struct armv7m_common *armv7m = target_to_armv7m(target);
+
+	if (!is_armv7m(armv7m))
+		return NULL;
+	return armv7m->debug_ap;
 }
 
+/* Erase one sector by queueing the whole bypass/CR/trigger sequence
+ * plus a first FLASH_CR status read, and flushing it in one go. */
+static int hc32l110_erase_sector_queued(struct adiv5_ap *ap, struct target *target,
+		unsigned long adr)
+{
+	uint32_t status;
+	int retval;
+
+	mem_ap_write_u32(ap, HC32L110_FLASH_BYPASS, 0x5a5a);
+	mem_ap_write_u32(ap, HC32L110_FLASH_BYPASS, 0xa5a5);
+	mem_ap_write_u32(ap, HC32L110_FLASH_CR, FLASH_OP_ERASE_SECTOR);
+	mem_ap_write_u32(ap, adr, 0); //trigger erase
+	mem_ap_read_u32(ap, HC32L110_FLASH_CR, &status);
+	retval = dap_run(ap->dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return hc32l110_wait_flash_ready(target, status, 50);
+}
 
 static int hc32l110_erase(struct flash_bank *bank, unsigned int first,
 		unsigned int last)
 {
 	unsigned int x;
 	struct target *target = bank->target;
+	uint32_t slock;
+	int retval;
 
 	/* mass erase */
-	if (((first | last) == 0) || ((first == 0) && (last >= bank->num_sectors))) {
+	if ((first == 0) && (last >= bank->num_sectors - 1)) {
 		LOG_DEBUG("performing mass erase.");
+		retval = hc32l110_sunlock(bank, 0, bank->size, &slock);
+		if (retval != ERROR_OK)
+			return retval;
 		hc32l110_bypass(target);
 		target_write_u32(target, HC32L110_FLASH_CR, FLASH_OP_ERASE_CHIP);
-		hc32l110_sunlock(target, 0, 32*1024);
 		target_write_u32(target, 0, 0); //trigger erase
 
-		if (hc32l110_check_flash_completion(target, 3500) != ERROR_OK) {
+		retval = hc32l110_check_flash_completion(target, 3500);
+		hc32l110_slock_restore(bank, slock);
+		if (retval != ERROR_OK) {
 			LOG_ERROR("mass erase failed");
 			return ERROR_FLASH_OPERATION_FAILED;
 		}
-		hc32l110_slock_all(target);
 
 		LOG_DEBUG("mass erase successful.");
 		return ERROR_OK;
 	} else {
 		unsigned long adr;
 
-		for (x = first; x < last; x++) {
+		struct adiv5_ap *ap = hc32l110_get_ap(target);
+
+		retval = hc32l110_sunlock(bank, first * FLASH_SECTOR_SIZE,
+				(last + 1) * FLASH_SECTOR_SIZE, &slock);
+		if (retval != ERROR_OK)
+			return retval;
+
+		for (x = first; x <= last; x++) {
 			adr = bank->base + (x * FLASH_SECTOR_SIZE);
 
-			hc32l110_bypass(target);
-			target_write_u32(target, HC32L110_FLASH_CR, FLASH_OP_ERASE_SECTOR);
-			hc32l110_bypass(target);
-			hc32l110_sunlock(target, adr, adr+FLASH_SECTOR_SIZE);
-			target_write_u32(target, HC32L110_FLASH_SLOCK, 1<<(x/4));
-			target_write_u32(target, adr, 0); //trigger erase
+			if (ap) {
+				retval = hc32l110_erase_sector_queued(ap, target, adr);
+			} else {
+				hc32l110_bypass(target);
+				target_write_u32(target, HC32L110_FLASH_CR, FLASH_OP_ERASE_SECTOR);
+				target_write_u32(target, adr, 0); //trigger erase
+				retval = hc32l110_check_flash_completion(target, 50);
+			}
 
-			if (hc32l110_check_flash_completion(target, 50) != ERROR_OK) {
+			if (retval != ERROR_OK) {
 				LOG_ERROR("failed to erase sector at address 0x%08lX", adr);
+				hc32l110_slock_restore(bank, slock);
 				return ERROR_FLASH_SECTOR_NOT_ERASED;
 			}
 
 			LOG_DEBUG("erased sector at address 0x%08lX", adr);
 		}
-		hc32l110_slock_all(target);
+		hc32l110_slock_restore(bank, slock);
 	}
 	return ERROR_OK;
 }
 
-/* All-JTAG, single-access method. Could be accelerated by having a method that does the
- * programming on the ARM itself. */
+/* All-JTAG, single-access method. Only used as a fallback when there is no working area
+ * to run the flash loader from. */
 static int hc32l110_write_single(struct flash_bank *bank,
 	const uint8_t *buffer,
 	uint32_t offset,
@@ -143,7 +212,6 @@ static int hc32l110_write_single(struct flash_bank *bank,
 
 	hc32l110_bypass(target);
 	target_write_u32(target, HC32L110_FLASH_CR, FLASH_OP_PROGRAM);
-	hc32l110_sunlock(target, offset&~3, (offset+count+3)&~3);
 	
 	//If we start at an address that is not aligned to 4, we need to
 	//also write the bytes before it to 0xff; we need to start earlier.
@@ -167,66 +235,367 @@ static int hc32l110_write_single(struct flash_bank *bank,
 			return ERROR_FLASH_OPERATION_FAILED;
 		}
 	}
-	hc32l110_slock_all(target);
 	LOG_DEBUG("wrote %d bytes at address 0x%08lX", (int)count, (unsigned long)(offset));
 
 	return ERROR_OK;
 }
 
+/* Program a run of words using the on-target loader. The target writes each word, polls
+ * FLASH_CR and reads the word back itself, so the adapter only has to keep the
+ * working-area FIFO full. */
+static int hc32l110_write_block(struct flash_bank *bank,
+	const uint8_t *buffer,
+	uint32_t address,
+	uint32_t count)
+{
+	struct target *target = bank->target;
+	uint32_t buffer_size = 1024;
+	struct working_area *write_algorithm;
+	struct working_area *source;
+	struct reg_param reg_params[5];
+	struct armv7m_algorithm armv7m_info;
+	int retval;
+
+	static const uint8_t hc32l110_flash_write_code[] = {
+#include "../../../contrib/loaders/flash/hc32l110/hc32l110.inc"
+	};
+
+	if (target_alloc_working_area(target, sizeof(hc32l110_flash_write_code),
+			&write_algorithm) != ERROR_OK) {
+		LOG_WARNING("no working area available, can't do block memory writes");
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+	}
+
+	retval = target_write_buffer(target, write_algorithm->address,
+			sizeof(hc32l110_flash_write_code), hc32l110_flash_write_code);
+	if (retval != ERROR_OK) {
+		target_free_working_area(target, write_algorithm);
+		return retval;
+	}
+
+	/* The HC32L110 only has 2 or 4KiB of SRAM, so start small. */
+	while (target_alloc_working_area_try(target, buffer_size, &source) != ERROR_OK) {
+		buffer_size /= 2;
+		if (buffer_size < 64) {
+			target_free_working_area(target, write_algorithm);
+			LOG_WARNING("no large enough working area available, can't do block memory writes");
+			return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		}
+	}
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_IN_OUT);	/* FLASH_CR (in), status (out) */
+	init_reg_param(&reg_params[1], "r1", 32, PARAM_OUT);	/* count (words) */
+	init_reg_param(&reg_params[2], "r2", 32, PARAM_OUT);	/* buffer start */
+	init_reg_param(&reg_params[3], "r3", 32, PARAM_OUT);	/* buffer end */
+	init_reg_param(&reg_params[4], "r4", 32, PARAM_IN_OUT);	/* target address */
+
+	buf_set_u32(reg_params[0].value, 0, 32, HC32L110_FLASH_CR);
+	buf_set_u32(reg_params[1].value, 0, 32, count);
+	buf_set_u32(reg_params[2].value, 0, 32, source->address);
+	buf_set_u32(reg_params[3].value, 0, 32, source->address + source->size);
+	buf_set_u32(reg_params[4].value, 0, 32, address);
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	retval = target_run_flash_async_algorithm(target, buffer, count, 4,
+			0, NULL,
+			5, reg_params,
+			source->address, source->size,
+			write_algorithm->address, 0,
+			&armv7m_info);
+
+	if (retval == ERROR_FLASH_OPERATION_FAILED)
+		LOG_ERROR("flash write failed at address 0x%08" PRIx32 ", read back 0x%08" PRIx32,
+				buf_get_u32(reg_params[4].value, 0, 32),
+				buf_get_u32(reg_params[0].value, 0, 32));
+
+	target_free_working_area(target, source);
+	target_free_working_area(target, write_algorithm);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(reg_params); i++)
+		destroy_reg_param(&reg_params[i]);
+
+	return retval;
+}
+
 static int hc32l110_write(struct flash_bank *bank, const uint8_t *buffer, uint32_t offset, uint32_t count)
 {
+	struct target *target = bank->target;
+	uint8_t *new_buffer = NULL;
 	int retval;
 
-	retval = hc32l110_write_single(bank, buffer, offset, count);
+	if (target->state != TARGET_HALTED) {
+		LOG_ERROR("Target not halted");
+		return ERROR_TARGET_NOT_HALTED;
+	}
+
+	/* The loader only does whole, aligned words; pad the edges with 0xff. */
+	uint32_t head = offset % 4;
+	uint32_t padded_count = (head + count + 3) & ~3;
+	if (head != 0 || padded_count != count) {
+		new_buffer = malloc(padded_count);
+		if (!new_buffer) {
+			LOG_ERROR("no memory for padding buffer");
+			return ERROR_FAIL;
+		}
+		memset(new_buffer, 0xff, padded_count);
+		memcpy(new_buffer + head, buffer, count);
+		buffer = new_buffer;
+		offset -= head;
+		count = padded_count;
+	}
+
+	uint32_t slock;
+	retval = hc32l110_sunlock(bank, offset, offset + count, &slock);
+	if (retval != ERROR_OK)
+		goto free_buffer;
+
+	hc32l110_bypass(target);
+	target_write_u32(target, HC32L110_FLASH_CR, FLASH_OP_PROGRAM);
+
+	retval = hc32l110_write_block(bank, buffer, bank->base + offset, count / 4);
+
+	if (retval == ERROR_TARGET_RESOURCE_NOT_AVAILABLE) {
+		LOG_WARNING("couldn't use block writes, falling back to single memory accesses");
+		retval = hc32l110_write_single(bank, buffer, offset, count);
+	}
+	hc32l110_slock_restore(bank, slock);
+
 	if (retval != ERROR_OK) {
 		LOG_ERROR("write failed");
-		return ERROR_FLASH_OPERATION_FAILED;
+		retval = ERROR_FLASH_OPERATION_FAILED;
 	}
+
+free_buffer:
+	free(new_buffer);
+	return retval;
+}
+
+/* Erase check using a loader that compares 16 bytes per iteration. */
+static int hc32l110_blank_check_memory(struct flash_bank *bank,
+	struct target_memory_check_block *blocks, unsigned int num_blocks)
+{
+	struct target *target = bank->target;
+	struct working_area *erase_check_algorithm;
+	struct working_area *erase_check_params;
+	struct reg_param reg_params[1];
+	struct armv7m_algorithm armv7m_info;
+	int retval;
+
+	static const uint8_t hc32l110_erase_check_code[] = {
+#include "../../../contrib/loaders/flash/hc32l110/hc32l110_erase_check.inc"
+	};
+
+	/* the loader can only check for all-ones in whole 16 byte chunks */
+	if (bank->erased_value != 0xff)
+		return target_blank_check_memory(target, blocks, num_blocks, bank->erased_value);
+
+	if (target_alloc_working_area(target, sizeof(hc32l110_erase_check_code),
+			&erase_check_algorithm) != ERROR_OK)
+		return ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+
+	retval = target_write_buffer(target, erase_check_algorithm->address,
+			sizeof(hc32l110_erase_check_code), hc32l110_erase_check_code);
+	if (retval != ERROR_OK)
+		goto free_algorithm;
+
+	unsigned int blocks_to_check = target_get_working_area_avail(target) / 8;
+	if (blocks_to_check < 2) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto free_algorithm;
+	}
+	blocks_to_check--;	/* room for the terminating entry */
+	if (blocks_to_check > num_blocks)
+		blocks_to_check = num_blocks;
+
+	uint32_t param_size = (blocks_to_check + 1) * 8;
+	uint8_t *params = calloc(1, param_size);
+	if (!params) {
+		retval = ERROR_FAIL;
+		goto free_algorithm;
+	}
+
+	for (unsigned int i = 0; i < blocks_to_check; i++) {
+		target_buffer_set_u32(target, params + i * 8, blocks[i].size);
+		target_buffer_set_u32(target, params + i * 8 + 4, blocks[i].address);
+	}
+
+	if (target_alloc_working_area(target, param_size, &erase_check_params) != ERROR_OK) {
+		retval = ERROR_TARGET_RESOURCE_NOT_AVAILABLE;
+		goto free_params;
+	}
+
+	retval = target_write_buffer(target, erase_check_params->address, param_size, params);
+	if (retval != ERROR_OK)
+		goto free_params_area;
+
+	armv7m_info.common_magic = ARMV7M_COMMON_MAGIC;
+	armv7m_info.core_mode = ARM_MODE_THREAD;
+
+	init_reg_param(&reg_params[0], "r0", 32, PARAM_OUT);
+	buf_set_u32(reg_params[0].value, 0, 32, erase_check_params->address);
+
+	retval = target_run_algorithm(target,
+			0, NULL,
+			ARRAY_SIZE(reg_params), reg_params,
+			erase_check_algorithm->address,
+			erase_check_algorithm->address + sizeof(hc32l110_erase_check_code) - 2,
+			1000, &armv7m_info);
+	destroy_reg_param(&reg_params[0]);
+	if (retval != ERROR_OK)
+		goto free_params_area;
+
+	retval = target_read_buffer(target, erase_check_params->address, param_size, params);
+	if (retval != ERROR_OK)
+		goto free_params_area;
+
+	for (unsigned int i = 0; i < blocks_to_check; i++)
+		blocks[i].result = target_buffer_get_u32(target, params + i * 8);
+	retval = blocks_to_check;
+
+free_params_area:
+	target_free_working_area(target, erase_check_params);
+free_params:
+	free(params);
+free_algorithm:
+	target_free_working_area(target, erase_check_algorithm);
+
 	return retval;
 }
 
 static int hc32l110_probe(struct flash_bank *bank)
 {
+	struct hc32l110_flash_bank *hc32l110_info = bank->driver_priv;
 	struct target *target = bank->target;
-	uint32_t flash_size=0;
-	target_read_u32(target, HC32L110_FLASH_SIZE, &flash_size); 
+	uint32_t flash_size = 0;
+	int retval;
+
+	hc32l110_info->probed = false;
+
+	retval = target_read_u32(target, HC32L110_FLASH_SIZE, &flash_size);
+	if (retval != ERROR_OK)
+		return retval;
 	if (flash_size>32768 || flash_size<4096) return ERROR_FLASH_OPERATION_FAILED;
 	LOG_INFO("%dKiB of flash detected.", flash_size/1024);
 	bank->size = flash_size;
 
-	uint32_t offset = 0;
+	free(bank->sectors);
+	bank->sectors = NULL;
+
+	free(bank->prot_blocks);
+	bank->prot_blocks = NULL;
+
 	bank->num_sectors = bank->size / FLASH_SECTOR_SIZE;
-	bank->sectors = malloc(sizeof(struct flash_sector) * bank->num_sectors);
-	for (unsigned int i = 0; i < bank->num_sectors; ++i) {
-		bank->sectors[i].offset = offset;
-		bank->sectors[i].size = FLASH_SECTOR_SIZE;
-		bank->sectors[i].is_erased = -1;
-		bank->sectors[i].is_protected = 0;
-		offset += bank->sectors[i].size;
+	bank->sectors = alloc_block_array(0, FLASH_SECTOR_SIZE, bank->num_sectors);
+	if (!bank->sectors)
+		return ERROR_FAIL;
+
+	/* SLOCK has one bit per 4KiB; expose those as protection blocks */
+	bank->num_prot_blocks = bank->size / SPROT_SEC_SIZE;
+	bank->prot_blocks = alloc_block_array(0, SPROT_SEC_SIZE, bank->num_prot_blocks);
+	if (!bank->prot_blocks)
+		return ERROR_FAIL;
+
+	hc32l110_info->probed = true;
+	return ERROR_OK;
+}
+
+static int hc32l110_auto_probe(struct flash_bank *bank)
+{
+	struct hc32l110_flash_bank *hc32l110_info = bank->driver_priv;
+
+	if (hc32l110_info->probed)
+		return ERROR_OK;
+	return hc32l110_probe(bank);
+}
+
+static int hc32l110_protect_check(struct flash_bank *bank)
+{
+	uint32_t slock;
+	int retval;
+
+	retval = target_read_u32(bank->target, HC32L110_FLASH_SLOCK, &slock);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < bank->num_prot_blocks; i++)
+		bank->prot_blocks[i].is_protected = (slock & (1 << i)) ? 0 : 1;
+
+	return ERROR_OK;
+}
+
+static int hc32l110_protect(struct flash_bank *bank, int set, unsigned int first,
+		unsigned int last)
+{
+	uint32_t slock;
+	int retval;
+
+	retval = target_read_u32(bank->target, HC32L110_FLASH_SLOCK, &slock);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = first; i <= last; i++) {
+		if (set)
+			slock &= ~(1 << i);
+		else
+			slock |= (1 << i);
 	}
+
+	hc32l110_bypass(bank->target);
+	retval = target_write_u32(bank->target, HC32L110_FLASH_SLOCK, slock);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = first; i <= last; i++)
+		bank->prot_blocks[i].is_protected = set;
+
 	return ERROR_OK;
 }
 
-/* wait up to timeout_ms for controller to not be busy,
- * then check whether the command passed or failed.
+/* Wait up to timeout_ms for the controller to not be busy, given the status
+ * of a FLASH_CR read the caller already did.
  *
- * this function sleeps 1ms between checks (after the first one),
- * so in some cases may slow things down without a usleep after the first read */
-static int hc32l110_check_flash_completion(struct target *target, unsigned int timeout_ms)
+ * Most operations finish in microseconds to a few milliseconds, so rather
+ * than sleeping a full millisecond between checks, start polling at 50us
+ * and back off exponentially up to 1ms. */
+static int hc32l110_wait_flash_ready(struct target *target, uint32_t status, unsigned int timeout_ms)
 {
-	uint32_t v = HC32L110_FLASH_CR_BUSY;
-
+	unsigned int delay_us = 50;
 	int64_t endtime = timeval_ms() + timeout_ms;
-	while (1) {
-		target_read_u32(target, HC32L110_FLASH_CR, &v);
-		if ((v & HC32L110_FLASH_CR_BUSY) == 0) break;
-		alive_sleep(1);
-		if (timeval_ms() >= endtime) break;
+	int retval;
+
+	while (status & HC32L110_FLASH_CR_BUSY) {
+		if (timeval_ms() > endtime) {
+			LOG_ERROR("timeout waiting for flash controller");
+			return ERROR_FLASH_OPERATION_FAILED;
+		}
+		usleep(delay_us);
+		keep_alive();
+		if (delay_us < 1000)
+			delay_us *= 2;
+
+		retval = target_read_u32(target, HC32L110_FLASH_CR, &status);
+		if (retval != ERROR_OK)
+			return retval;
 	}
 
 	return ERROR_OK;
 }
 
+/* wait up to timeout_ms for controller to not be busy */
+static int hc32l110_check_flash_completion(struct target *target, unsigned int timeout_ms)
+{
+	uint32_t v;
+	int retval;
+
+	retval = target_read_u32(target, HC32L110_FLASH_CR, &v);
+	if (retval != ERROR_OK)
+		return retval;
+
+	return hc32l110_wait_flash_ready(target, v, timeout_ms);
+}
+
 const struct flash_driver hc32l110_flash = {
 	.name = "hc32l110",
 	.flash_bank_command = hc32l110_flash_bank_command,
@@ -234,7 +603,10 @@ const struct flash_driver hc32l110_flash = {
 	.write = hc32l110_write,
 	.read = default_flash_read,
 	.probe = hc32l110_probe,
-	.auto_probe = hc32l110_probe,
+	.auto_probe = hc32l110_auto_probe,
 	.erase_check = default_flash_blank_check,
+	.blank_check_memory = hc32l110_blank_check_memory,
+	.protect = hc32l110_protect,
+	.protect_check = hc32l110_protect_check,
 	.free_driver_priv = default_flash_free_driver_priv,
 };
@@ -48,8 +48,23 @@ int flash_driver_read(struct flash_bank *bank,
 int flash_driver_verify(struct flash_bank *bank,
 		const uint8_t *buffer, uint32_t offset, uint32_t count);
 
-/* write (optional verify) an image to flash memory of the given target */
+/* write (optional verify) an image to flash memory of the given target;
+ * in incremental mode only the sectors whose contents differ get erased and written */
 int flash_write_unlock_verify(struct target *target, struct image *image,
-		uint32_t *written, bool erase, bool unlock, bool write, bool verify);
+		uint32_t *written, bool erase, bool unlock, bool write, bool verify,
+		bool incremental);
+
+/* persistent per-sector CRC cache for incremental writes, see sector_cache.c */
+int flash_sector_cache_open(const char *filename);
+void flash_sector_cache_close(void);
+const char *flash_sector_cache_filename(void);
+const uint32_t *flash_sector_cache_lookup(struct flash_bank *bank, uint32_t bank_crc);
+int flash_sector_cache_store(struct flash_bank *bank, uint32_t bank_crc,
+		const uint32_t *sector_crcs);
+
+static inline bool flash_sector_cache_enabled(void)
+{
+	return flash_sector_cache_filename() != NULL;
+}
 
 #endif /* OPENOCD_FLASH_NOR_IMP_H */
@@ -0,0 +1,230 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "imp.h"
+
+/*
+ * Persistent cache of per-sector CRCs, used by incremental flash writes.
+ *
+ * Each entry describes the contents of one flash bank by the CRC of the
+ * whole bank plus the CRC of every sector in it. Entries are found by bank
+ * geometry and the whole-bank CRC, which is computed on the target before
+ * the cache is consulted, so a stale or foreign entry can never match: no
+ * board identity is needed, and all boards holding the same firmware share
+ * one entry. On a hit the per-sector CRCs of the image are compared with
+ * the cached ones on the host, instead of running a checksum on the target
+ * for every sector.
+ *
+ * The file is plain text, one entry per line:
+ * <bank name> <base> <size> <bank crc> <num sectors> <sector crc>...
+ */
+
+#define SECTOR_CACHE_MAX_ENTRIES 32
+/* enough for a bank of 8192 sectors */
+#define SECTOR_CACHE_LINE_SIZE (256 + 8192 * 9)
+
+struct sector_cache_entry {
+	char *bank_name;
+	target_addr_t base;
+	uint32_t size;
+	uint32_t bank_crc;
+	unsigned int num_sectors;
+	uint32_t *sector_crcs;
+};
+
+static char *sector_cache_file;
+static struct sector_cache_entry sector_cache[SECTOR_CACHE_MAX_ENTRIES];
+static unsigned int sector_cache_count;
+
+static void sector_cache_free_entry(struct sector_cache_entry *entry)
+{
+	free(entry->bank_name);
+	free(entry->sector_crcs);
+	memset(entry, 0, sizeof(*entry));
+}
+
+/* Make room for a new entry at the end, dropping the oldest one if full */
+static struct sector_cache_entry *sector_cache_new_entry(void)
+{
+	if (sector_cache_count == SECTOR_CACHE_MAX_ENTRIES) {
+		sector_cache_free_entry(&sector_cache[0]);
+		memmove(&sector_cache[0], &sector_cache[1],
+			(SECTOR_CACHE_MAX_ENTRIES - 1) * sizeof(sector_cache[0]));
+		sector_cache_count--;
+		memset(&sector_cache[sector_cache_count], 0, sizeof(sector_cache[0]));
+	}
+	return &sector_cache[sector_cache_count++];
+}
+
+static int sector_cache_parse_line(char *line)
+{
+	char name[128];
+	unsigned long long base;
+	uint32_t size, bank_crc;
+	unsigned int num_sectors;
+	int pos;
+
+	if (sscanf(line, "%127s %llx %" SCNx32 " %" SCNx32 " %u%n", name, &base, &size,
+			&bank_crc, &num_sectors, &pos) != 5 || num_sectors == 0)
+		return ERROR_FAIL;
+
+	uint32_t *crcs = malloc(num_sectors * sizeof(uint32_t));
+	if (!crcs)
+		return ERROR_FAIL;
+
+	char *p = line + pos;
+	for (unsigned int i = 0; i < num_sectors; i++) {
+		char *end;
+		crcs[i] = strtoul(p, &end, 16);
+		if (end == p) {
+			free(crcs);
+			return ERROR_FAIL;
+		}
+		p = end;
+	}
+
+	struct sector_cache_entry *entry = sector_cache_new_entry();
+	entry->bank_name = strdup(name);
+	entry->base = base;
+	entry->size = size;
+	entry->bank_crc = bank_crc;
+	entry->num_sectors = num_sectors;
+	entry->sector_crcs = crcs;
+	return ERROR_OK;
+}
+
+static int sector_cache_save(void)
+{
+	FILE *f = fopen(sector_cache_file, "w");
+	if (!f) {
+		LOG_ERROR("couldn't write flash sector cache %s: %s",
+			sector_cache_file, strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	for (unsigned int i = 0; i < sector_cache_count; i++) {
+		struct sector_cache_entry *entry = &sector_cache[i];
+
+		fprintf(f, "%s " TARGET_ADDR_FMT " 0x%08" PRIx32 " 0x%08" PRIx32 " %u",
+			entry->bank_name, entry->base, entry->size,
+			entry->bank_crc, entry->num_sectors);
+		for (unsigned int j = 0; j < entry->num_sectors; j++)
+			fprintf(f, " %08" PRIx32, entry->sector_crcs[j]);
+		fputc('\n', f);
+	}
+
+	fclose(f);
+	return ERROR_OK;
+}
+
+void flash_sector_cache_close(void)
+{
+	for (unsigned int i = 0; i < sector_cache_count; i++)
+		sector_cache_free_entry(&sector_cache[i]);
+	sector_cache_count = 0;
+
+	free(sector_cache_file);
+	sector_cache_file = NULL;
+}
+
+int flash_sector_cache_open(const char *filename)
+{
+	flash_sector_cache_close();
+
+	sector_cache_file = strdup(filename);
+	if (!sector_cache_file)
+		return ERROR_FAIL;
+
+	FILE *f = fopen(filename, "r");
+	if (!f) {
+		/* a new cache file is created on first use */
+		return ERROR_OK;
+	}
+
+	char *line = malloc(SECTOR_CACHE_LINE_SIZE);
+	if (!line) {
+		fclose(f);
+		return ERROR_FAIL;
+	}
+
+	unsigned int line_nr = 0;
+	while (fgets(line, SECTOR_CACHE_LINE_SIZE, f)) {
+		line_nr++;
+		if (sector_cache_parse_line(line) != ERROR_OK)
+			LOG_WARNING("%s:%u: ignoring malformed flash sector cache entry",
+				filename, line_nr);
+	}
+	free(line);
+	fclose(f);
+
+	LOG_DEBUG("loaded %u flash sector cache entries from %s", sector_cache_count, filename);
+	return ERROR_OK;
+}
+
+const char *flash_sector_cache_filename(void)
+{
+	return sector_cache_file;
+}
+
+static struct sector_cache_entry *sector_cache_find(struct flash_bank *bank, uint32_t bank_crc)
+{
+	for (unsigned int i = 0; i < sector_cache_count; i++) {
+		struct sector_cache_entry *entry = &sector_cache[i];
+
+		if (entry->bank_crc == bank_crc && entry->base == bank->base
+				&& entry->size == bank->size
+				&& entry->num_sectors == bank->num_sectors
+				&& strcmp(entry->bank_name, bank->name) == 0)
+			return entry;
+	}
+	return NULL;
+}
+
+const uint32_t *flash_sector_cache_lookup(struct flash_bank *bank, uint32_t bank_crc)
+{
+	struct sector_cache_entry *entry = sector_cache_find(bank, bank_crc);
+
+	return entry ? entry->sector_crcs : NULL;
+}
+
+int flash_sector_cache_store(struct flash_bank *bank, uint32_t bank_crc,
+		const uint32_t *sector_crcs)
+{
+	if (!sector_cache_file)
+		return ERROR_OK;
+
+	struct sector_cache_entry *entry = sector_cache_find(bank, bank_crc);
+	if (!entry) {
+		entry = sector_cache_new_entry();
+		entry->bank_name = strdup(bank->name);
+		entry->base = bank->base;
+		entry->size = bank->size;
+		entry->bank_crc = bank_crc;
+		entry->num_sectors = bank->num_sectors;
+		entry->sector_crcs = malloc(bank->num_sectors * sizeof(uint32_t));
+		if (!entry->bank_name || !entry->sector_crcs) {
+			sector_cache_free_entry(entry);
+			sector_cache_count--;
+			return ERROR_FAIL;
+		}
+	}
+	memcpy(entry->sector_crcs, sector_crcs, bank->num_sectors * sizeof(uint32_t));
+
+	return sector_cache_save();
+}
@@ -412,6 +412,7 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 	/* flash auto-erase is disabled by default*/
 	int auto_erase = 0;
 	bool auto_unlock = false;
+	bool incremental = false;
 
 	while (CMD_ARGC) {
 		if (strcmp(CMD_ARGV[0], "erase") == 0) {
@@ -424,6 +425,11 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 			CMD_ARGV++;
 			CMD_ARGC--;
 			command_print(CMD, "auto unlock enabled");
+		} else if (strcmp(CMD_ARGV[0], "incremental") == 0) {
+			incremental = true;
+			CMD_ARGV++;
+			CMD_ARGC--;
+			command_print(CMD, "incremental write enabled");
 		} else
 			break;
 	}
@@ -454,7 +460,7 @@ COMMAND_HANDLER(handle_flash_write_image_command)
 		return retval;
 
 	retval = flash_write_unlock_verify(target, &image, &written, auto_erase,
-		auto_unlock, true, false);
+		auto_unlock, true, false, incremental);
 	if (retval != ERROR_OK) {
 		image_close(&image);
 		return retval;
@@ -506,7 +512,7 @@ COMMAND_HANDLER(handle_flash_verify_image_command)
 		return retval;
 
 	retval = flash_write_unlock_verify(target, &image, &verified, false,
-		false, false, true);
+		false, false, true, false);
 	if (retval != ERROR_OK) {
 		image_close(&image);
 		return retval;
@@ -1192,9 +1198,10 @@ static const struct command_registration flash_exec_command_handlers[] = {
 		.name = "write_image",
 		.handler = handle_flash_write_image_command,
 		.mode = COMMAND_EXEC,
-		.usage = "[erase] [unlock] filename [offset [file_type]]",
+		.usage = "[erase] [unlock] [incremental] filename [offset [file_type]]",
 		.help = "Write an image to flash.  Optionally first unprotect "
-			"and/or erase the region to be used. Allow optional "
+			"and/or erase the region to be used, or only erase and "
+			"write the sectors that differ from the image. Allow optional "
 			"offset from beginning of bank (defaults to zero)",
 	},
 	{
@@ -1335,6 +1342,28 @@ COMMAND_HANDLER(handle_flash_banks_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_flash_sector_cache_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		if (strcmp(CMD_ARGV[0], "off") == 0) {
+			flash_sector_cache_close();
+		} else {
+			int retval = flash_sector_cache_open(CMD_ARGV[0]);
+			if (retval != ERROR_OK)
+				return retval;
+		}
+	}
+
+	if (flash_sector_cache_enabled())
+		command_print(CMD, "flash sector cache: %s", flash_sector_cache_filename());
+	else
+		command_print(CMD, "flash sector cache: off");
+	return ERROR_OK;
+}
+
 static int jim_flash_list(Jim_Interp *interp, int argc, Jim_Obj * const *argv)
 {
 	if (argc != 1) {
@@ -1412,6 +1441,14 @@ static const struct command_registration flash_config_command_handlers[] = {
 		.help = "Display table with information about flash banks.",
 		.usage = "",
 	},
+	{
+		.name = "sector_cache",
+		.mode = COMMAND_ANY,
+		.handler = handle_flash_sector_cache_command,
+		.help = "Keep CRCs of flash sectors in a file, so that writes "
+			"can skip sectors that already hold the right data.",
+		.usage = "[filename|off]",
+	},
 	{
 		.name = "list",
 		.mode = COMMAND_ANY,
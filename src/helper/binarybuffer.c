@@ -350,6 +350,22 @@ void bit_copy_discard(struct bit_copy_queue *q)
 	}
 }
 
+/* value of each hex digit, or -1 for characters that aren't one */
+static int8_t hex_values[256];
+static bool hex_values_valid;
+
+static void hex_values_init(void)
+{
+	memset(hex_values, -1, sizeof(hex_values));
+	for (int i = 0; i < 10; i++)
+		hex_values['0' + i] = i;
+	for (int i = 0; i < 6; i++) {
+		hex_values['a' + i] = 10 + i;
+		hex_values['A' + i] = 10 + i;
+	}
+	hex_values_valid = true;
+}
+
 /**
  * Convert a string of hexadecimal pairs into its binary
  * representation.
@@ -365,34 +381,40 @@ void bit_copy_discard(struct bit_copy_queue *q)
 size_t unhexify(uint8_t *bin, const char *hex, size_t count)
 {
 	size_t i;
-	char tmp;
 
 	if (!bin || !hex)
 		return 0;
 
-	memset(bin, 0, count);
+	if (!hex_values_valid)
+		hex_values_init();
 
-	for (i = 0; i < 2 * count; i++) {
-		if (hex[i] >= 'a' && hex[i] <= 'f')
-			tmp = hex[i] - 'a' + 10;
-		else if (hex[i] >= 'A' && hex[i] <= 'F')
-			tmp = hex[i] - 'A' + 10;
-		else if (hex[i] >= '0' && hex[i] <= '9')
-			tmp = hex[i] - '0';
-		else
-			return i / 2;
+	for (i = 0; i < count; i++) {
+		int8_t high = hex_values[(uint8_t)hex[2 * i]];
+		if (high < 0)
+			break;
 
-		bin[i / 2] |= tmp << (4 * ((i + 1) % 2));
+		int8_t low = hex_values[(uint8_t)hex[2 * i + 1]];
+		if (low < 0) {
+			/* keep the half converted byte, as before */
+			bin[i] = high << 4;
+			memset(bin + i + 1, 0, count - i - 1);
+			return i;
+		}
+
+		bin[i] = (high << 4) | low;
 	}
 
-	return i / 2;
+	memset(bin + i, 0, count - i);
+	return i;
 }
 
 /**
  * Convert binary data into a string of hexadecimal pairs.
  *
  * @param[out] hex Buffer to store string of hexadecimal pairs. The buffer size
- *                 must be at least @p length.
+ *                 must be at least @p length. It may overlap @p bin if it
+ *                 starts at least @p count bytes before it, so a buffer can
+ *                 be converted in place from its upper half.
  * @param[in] bin Buffer with binary data to convert into hexadecimal pairs.
  * @param[in] count Number of bytes to convert.
  * @param[in] length Maximum number of characters, including null-terminator,
@@ -402,15 +424,26 @@ size_t unhexify(uint8_t *bin, const char *hex, size_t count)
  */
 size_t hexify(char *hex, const uint8_t *bin, size_t count, size_t length)
 {
-	size_t i;
-	uint8_t tmp;
+	size_t i, bytes;
 
 	if (!length)
 		return 0;
 
-	for (i = 0; i < length - 1 && i < 2 * count; i++) {
-		tmp = (bin[i / 2] >> (4 * ((i + 1) % 2))) & 0x0f;
-		hex[i] = hex_digits[tmp];
+	bytes = (length - 1) / 2;
+	if (bytes > count)
+		bytes = count;
+
+	for (i = 0; i < bytes; i++) {
+		uint8_t tmp = bin[i];
+		hex[2 * i] = hex_digits[tmp >> 4];
+		hex[2 * i + 1] = hex_digits[tmp & 0x0f];
+	}
+	i *= 2;
+
+	/* room for only the upper half of the next byte */
+	if (i < length - 1 && i < 2 * count) {
+		hex[i] = hex_digits[bin[i / 2] >> 4];
+		i++;
 	}
 
 	hex[i] = 0;
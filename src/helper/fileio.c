@@ -31,12 +31,17 @@
 #include "fileio.h"
 #include "replacements.h"
 
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
 struct fileio {
 	char *url;
 	size_t size;
 	enum fileio_type type;
 	enum fileio_access access;
 	FILE *file;
+	void *mapping;
 };
 
 static inline int fileio_close_local(struct fileio *fileio)
@@ -128,6 +133,7 @@ int fileio_open(struct fileio **fileio, const char *url,
 	tmp->type = type;
 	tmp->access = access_type;
 	tmp->url = strdup(url);
+	tmp->mapping = NULL;
 
 	retval = fileio_open_local(tmp);
 
@@ -146,6 +152,11 @@ int fileio_close(struct fileio *fileio)
 {
 	int retval;
 
+#ifdef HAVE_SYS_MMAN_H
+	if (fileio->mapping)
+		munmap(fileio->mapping, fileio->size);
+#endif
+
 	retval = fileio_close_local(fileio);
 
 	free(fileio->url);
@@ -173,6 +184,21 @@ int fileio_seek(struct fileio *fileio, size_t position)
 	return ERROR_OK;
 }
 
+/* Current position, which fileio_seek() can return to later; for text
+ * files that is all it is good for */
+int fileio_tell(struct fileio *fileio, size_t *position)
+{
+	long offset = ftell(fileio->file);
+
+	if (offset < 0) {
+		LOG_ERROR("couldn't get position in file %s: %s", fileio->url, strerror(errno));
+		return ERROR_FILEIO_OPERATION_FAILED;
+	}
+
+	*position = offset;
+	return ERROR_OK;
+}
+
 static int fileio_local_read(struct fileio *fileio, size_t size, void *buffer,
 		size_t *size_read)
 {
@@ -258,6 +284,39 @@ int fileio_write_u32(struct fileio *fileio, uint32_t data)
 	return retval;
 }
 
+/**
+ * Map the whole of a file opened for binary reading into memory, so its
+ * contents can be used in place without copying them through stdio.
+ * The mapping stays valid until the file is closed.
+ *
+ * @returns ERROR_FILEIO_OPERATION_NOT_SUPPORTED if the host or the file
+ * (e.g. an empty one, or a pipe) can't be mapped; the caller should then
+ * fall back to fileio_read().
+ */
+int fileio_mmap(struct fileio *fileio, const uint8_t **data)
+{
+#ifdef HAVE_SYS_MMAN_H
+	if (!fileio->mapping) {
+		if (fileio->access != FILEIO_READ || fileio->type != FILEIO_BINARY
+				|| fileio->size == 0)
+			return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+
+		void *mapping = mmap(NULL, fileio->size, PROT_READ, MAP_PRIVATE,
+				fileno(fileio->file), 0);
+		if (mapping == MAP_FAILED) {
+			LOG_DEBUG("couldn't map %s: %s", fileio->url, strerror(errno));
+			return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+		}
+		fileio->mapping = mapping;
+	}
+
+	*data = fileio->mapping;
+	return ERROR_OK;
+#else
+	return ERROR_FILEIO_OPERATION_NOT_SUPPORTED;
+#endif
+}
+
 /**
  * FIX!!!!
  *
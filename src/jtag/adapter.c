@@ -16,6 +16,7 @@
 #include "minidriver.h"
 #include "interface.h"
 #include "interfaces.h"
+#include "adapter_stats.h"
 #include <transport/transport.h>
 
 #ifdef HAVE_STRINGS_H
@@ -74,6 +75,7 @@ int adapter_init(struct command_context *cmd_ctx)
 	if (retval != ERROR_OK)
 		return retval;
 	adapter_config.adapter_initialized = true;
+	adapter_stats_reset();
 
 	if (!adapter_driver->speed) {
 		LOG_INFO("This adapter doesn't support configurable speed");
@@ -879,6 +881,9 @@ static const struct command_registration adapter_command_handlers[] = {
 		.help = "Controls SRST and TRST lines.",
 		.usage = "|assert [srst|trst [deassert|assert srst|trst]]",
 	},
+	{
+		.chain = adapter_stats_command_handlers,
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
@@ -0,0 +1,232 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/time_support.h>
+
+#include "interface.h"
+#include "swd.h"
+#include "adapter_stats.h"
+
+/*
+ * Adapter traffic statistics.
+ *
+ * Queue flushes, USB transfers, SWD WAIT/FAULT responses and DAP bank
+ * selects that could be skipped are counted per high level operation, so
+ * it is visible whether time goes to GDB, flash programming or polling.
+ * Flush and transfer latencies are kept as histograms with power of two
+ * buckets: bucket i counts latencies below 2^(i+1) microseconds, the last
+ * bucket everything longer.
+ *
+ * Writing them to a file periodically needs the target timer callbacks, so
+ * that part of the "adapter stats" command lives in the target layer.
+ */
+
+#define ADAPTER_STATS_BUCKETS	20
+
+enum adapter_stats_histogram {
+	ADAPTER_STATS_FLUSH_US,
+	ADAPTER_STATS_TRANSFER_US,
+	ADAPTER_STATS_HISTOGRAM_NUM
+};
+
+struct adapter_stats {
+	uint64_t counters[ADAPTER_STATS_COUNTER_NUM];
+	uint64_t histograms[ADAPTER_STATS_HISTOGRAM_NUM][ADAPTER_STATS_BUCKETS];
+};
+
+static const char * const adapter_stats_op_names[ADAPTER_STATS_OP_NUM] = {
+	[ADAPTER_STATS_OP_OTHER] = "other",
+	[ADAPTER_STATS_OP_GDB] = "gdb",
+	[ADAPTER_STATS_OP_FLASH] = "flash",
+	[ADAPTER_STATS_OP_POLL] = "poll",
+};
+
+static const char * const adapter_stats_counter_names[ADAPTER_STATS_COUNTER_NUM] = {
+	[ADAPTER_STATS_FLUSHES] = "flushes",
+	[ADAPTER_STATS_TRANSFERS] = "transfers",
+	[ADAPTER_STATS_BYTES_OUT] = "bytes_out",
+	[ADAPTER_STATS_BYTES_IN] = "bytes_in",
+	[ADAPTER_STATS_SWD_WAIT] = "swd_wait",
+	[ADAPTER_STATS_SWD_FAULT] = "swd_fault",
+	[ADAPTER_STATS_BANKSEL_AVOIDED] = "bank_select_avoided",
+};
+
+static const char * const adapter_stats_histogram_names[ADAPTER_STATS_HISTOGRAM_NUM] = {
+	[ADAPTER_STATS_FLUSH_US] = "flush_us",
+	[ADAPTER_STATS_TRANSFER_US] = "transfer_us",
+};
+
+extern struct adapter_driver *adapter_driver;
+
+static struct adapter_stats adapter_stats[ADAPTER_STATS_OP_NUM];
+static enum adapter_stats_op adapter_stats_op = ADAPTER_STATS_OP_OTHER;
+static int64_t adapter_stats_since;
+
+enum adapter_stats_op adapter_stats_enter(enum adapter_stats_op op)
+{
+	enum adapter_stats_op previous = adapter_stats_op;
+
+	adapter_stats_op = op;
+	return previous;
+}
+
+void adapter_stats_leave(enum adapter_stats_op previous)
+{
+	adapter_stats_op = previous;
+}
+
+void adapter_stats_count(enum adapter_stats_counter counter, uint64_t n)
+{
+	adapter_stats[adapter_stats_op].counters[counter] += n;
+}
+
+void adapter_stats_swd_ack(uint8_t ack)
+{
+	if (ack == SWD_ACK_WAIT)
+		adapter_stats_count(ADAPTER_STATS_SWD_WAIT, 1);
+	else if (ack != SWD_ACK_OK)
+		adapter_stats_count(ADAPTER_STATS_SWD_FAULT, 1);
+}
+
+int64_t adapter_stats_start(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static void adapter_stats_histogram_add(enum adapter_stats_histogram histogram, int64_t start)
+{
+	int64_t us = adapter_stats_start() - start;
+	unsigned int bucket = 0;
+
+	while (bucket < ADAPTER_STATS_BUCKETS - 1 && us >= (2LL << bucket))
+		bucket++;
+	adapter_stats[adapter_stats_op].histograms[histogram][bucket]++;
+}
+
+void adapter_stats_flush_done(int64_t start)
+{
+	adapter_stats_count(ADAPTER_STATS_FLUSHES, 1);
+	adapter_stats_histogram_add(ADAPTER_STATS_FLUSH_US, start);
+}
+
+void adapter_stats_transfer_done(int64_t start, size_t bytes_out, size_t bytes_in)
+{
+	adapter_stats_count(ADAPTER_STATS_TRANSFERS, 1);
+	adapter_stats_count(ADAPTER_STATS_BYTES_OUT, bytes_out);
+	adapter_stats_count(ADAPTER_STATS_BYTES_IN, bytes_in);
+	adapter_stats_histogram_add(ADAPTER_STATS_TRANSFER_US, start);
+}
+
+void adapter_stats_reset(void)
+{
+	memset(adapter_stats, 0, sizeof(adapter_stats));
+	adapter_stats_since = adapter_stats_start();
+}
+
+struct adapter_stats_json {
+	char *buf;
+	size_t size;
+	size_t len;
+};
+
+static void adapter_stats_json_printf(struct adapter_stats_json *json, const char *format, ...)
+	__attribute__ ((format (PRINTF_ATTRIBUTE_FORMAT, 2, 3)));
+
+static void adapter_stats_json_printf(struct adapter_stats_json *json, const char *format, ...)
+{
+	va_list ap;
+
+	if (json->len >= json->size)
+		return;
+
+	va_start(ap, format);
+	int n = vsnprintf(json->buf + json->len, json->size - json->len, format, ap);
+	va_end(ap);
+
+	if (n > 0)
+		json->len += n;
+}
+
+void adapter_stats_format(char *buf, size_t size)
+{
+	struct adapter_stats_json json_buf = { .buf = buf, .size = size };
+	struct adapter_stats_json *json = &json_buf;
+
+	buf[0] = '\0';
+	adapter_stats_json_printf(json, "{\"adapter\": \"%s\", \"seconds\": %.3f, \"operations\": {",
+			adapter_driver ? adapter_driver->name : "",
+			(adapter_stats_start() - adapter_stats_since) / 1000000.0);
+
+	for (unsigned int op = 0; op < ADAPTER_STATS_OP_NUM; op++) {
+		struct adapter_stats *stats = &adapter_stats[op];
+
+		adapter_stats_json_printf(json, "%s\"%s\": {", op ? ", " : "", adapter_stats_op_names[op]);
+		for (unsigned int i = 0; i < ADAPTER_STATS_COUNTER_NUM; i++)
+			adapter_stats_json_printf(json, "\"%s\": %" PRIu64 ", ",
+					adapter_stats_counter_names[i], stats->counters[i]);
+		for (unsigned int i = 0; i < ADAPTER_STATS_HISTOGRAM_NUM; i++) {
+			adapter_stats_json_printf(json, "%s\"%s\": [", i ? ", " : "",
+					adapter_stats_histogram_names[i]);
+			for (unsigned int j = 0; j < ADAPTER_STATS_BUCKETS; j++)
+				adapter_stats_json_printf(json, "%s%" PRIu64, j ? ", " : "",
+						stats->histograms[i][j]);
+			adapter_stats_json_printf(json, "]");
+		}
+		adapter_stats_json_printf(json, "}");
+	}
+
+	adapter_stats_json_printf(json, "}}");
+}
+
+COMMAND_HANDLER(handle_adapter_stats_command)
+{
+	if (CMD_ARGC == 0) {
+		char *json = malloc(ADAPTER_STATS_JSON_SIZE);
+		if (!json) {
+			LOG_ERROR("Out of memory");
+			return ERROR_FAIL;
+		}
+		adapter_stats_format(json, ADAPTER_STATS_JSON_SIZE);
+		command_print(CMD, "%s", json);
+		free(json);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "reset")) {
+		adapter_stats_reset();
+		return ERROR_OK;
+	}
+
+	return ERROR_COMMAND_SYNTAX_ERROR;
+}
+
+const struct command_registration adapter_stats_command_handlers[] = {
+	{
+		.name = "stats",
+		.handler = handle_adapter_stats_command,
+		.mode = COMMAND_ANY,
+		.help = "display adapter traffic statistics as JSON or reset them",
+		.usage = "['reset']",
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -0,0 +1,71 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_JTAG_ADAPTER_STATS_H
+#define OPENOCD_JTAG_ADAPTER_STATS_H
+
+#include <helper/command.h>
+#include <helper/types.h>
+
+/** High level operations adapter traffic is attributed to. */
+enum adapter_stats_op {
+	ADAPTER_STATS_OP_OTHER,
+	ADAPTER_STATS_OP_GDB,
+	ADAPTER_STATS_OP_FLASH,
+	ADAPTER_STATS_OP_POLL,
+	ADAPTER_STATS_OP_NUM
+};
+
+enum adapter_stats_counter {
+	ADAPTER_STATS_FLUSHES,
+	ADAPTER_STATS_TRANSFERS,
+	ADAPTER_STATS_BYTES_OUT,
+	ADAPTER_STATS_BYTES_IN,
+	ADAPTER_STATS_SWD_WAIT,
+	ADAPTER_STATS_SWD_FAULT,
+	ADAPTER_STATS_BANKSEL_AVOIDED,
+	ADAPTER_STATS_COUNTER_NUM
+};
+
+/** Buffer size that holds all statistics formatted by adapter_stats_format() */
+#define ADAPTER_STATS_JSON_SIZE	8192
+
+extern const struct command_registration adapter_stats_command_handlers[];
+
+/** Clear all statistics, e.g. when the adapter is initialized. */
+void adapter_stats_reset(void);
+/** Format all statistics as one line of JSON into @a buf. */
+void adapter_stats_format(char *buf, size_t size);
+
+/**
+ * Attribute adapter traffic to @a op until adapter_stats_leave().
+ * @returns the previous operation, to be passed to adapter_stats_leave()
+ */
+enum adapter_stats_op adapter_stats_enter(enum adapter_stats_op op);
+void adapter_stats_leave(enum adapter_stats_op previous);
+
+void adapter_stats_count(enum adapter_stats_counter counter, uint64_t n);
+/** Count a non-OK SWD ACK as WAIT or FAULT. */
+void adapter_stats_swd_ack(uint8_t ack);
+
+/** @returns a timestamp to pass to adapter_stats_flush_done() or
+ * adapter_stats_transfer_done() */
+int64_t adapter_stats_start(void);
+/** Record a queue flush that started at @a start. */
+void adapter_stats_flush_done(int64_t start);
+/** Record a USB transfer that started at @a start. */
+void adapter_stats_transfer_done(int64_t start, size_t bytes_out, size_t bytes_in);
+
+#endif /* OPENOCD_JTAG_ADAPTER_STATS_H */
@@ -31,6 +31,7 @@
 #endif
 
 #include "adapter.h"
+#include "adapter_stats.h"
 #include "jtag.h"
 #include "swd.h"
 #include "interface.h"
@@ -1011,8 +1012,11 @@ int default_interface_jtag_execute_queue(void)
 
 void jtag_execute_queue_noclear(void)
 {
+	int64_t start = adapter_stats_start();
+
 	jtag_flush_queue_count++;
 	jtag_set_error(interface_jtag_execute_queue());
+	adapter_stats_flush_done(start);
 
 	if (jtag_flush_queue_sleep > 0) {
 		/* For debug purposes it can be useful to test performance
@@ -1023,6 +1027,11 @@ void jtag_execute_queue_noclear(void)
 	}
 }
 
+void jtag_count_flush(void)
+{
+	jtag_flush_queue_count++;
+}
+
 int jtag_get_flush_queue_count(void)
 {
 	return jtag_flush_queue_count;
@@ -29,6 +29,7 @@
 #include "bitbang.h"
 #include <jtag/interface.h>
 #include <jtag/commands.h>
+#include <jtag/adapter_stats.h>
 
 /**
  * Function bitbang_stableclocks
@@ -498,6 +499,7 @@ static void bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay
 			  (cmd & SWD_CMD_A32) >> 1,
 			  data);
 
+		adapter_stats_swd_ack(ack);
 		if (ack == SWD_ACK_WAIT) {
 			swd_clear_sticky_errors();
 			continue;
@@ -555,6 +557,7 @@ static void bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay
 			  buf_get_u32(trn_ack_data_parity_trn, 1 + 3 + 1, 32));
 
 		if (check_ack) {
+			adapter_stats_swd_ack(ack);
 			if (ack == SWD_ACK_WAIT) {
 				swd_clear_sticky_errors();
 				continue;
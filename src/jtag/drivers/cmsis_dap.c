@@ -41,6 +41,7 @@
 #include <transport/transport.h>
 #include "helper/replacements.h"
 #include <jtag/adapter.h>
+#include <jtag/adapter_stats.h>
 #include <jtag/swd.h>
 #include <jtag/interface.h>
 #include <jtag/commands.h>
@@ -360,6 +361,7 @@ static int cmsis_dap_xfer(struct cmsis_dap *dap, int txlen)
 	}
 
 	uint8_t current_cmd = cmsis_dap_handle->command[0];
+	int64_t start = adapter_stats_start();
 	int retval = dap->backend->write(dap, txlen, USB_TIMEOUT);
 	if (retval < 0)
 		return retval;
@@ -368,6 +370,7 @@ static int cmsis_dap_xfer(struct cmsis_dap *dap, int txlen)
 	retval = dap->backend->read(dap, USB_TIMEOUT);
 	if (retval < 0)
 		return retval;
+	adapter_stats_transfer_done(start, txlen, retval);
 
 	uint8_t *resp = cmsis_dap_handle->response;
 	if (resp[0] == DAP_ERROR) {
@@ -826,6 +829,7 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 		}
 	}
 
+	int64_t start = adapter_stats_start();
 	int retval = dap->backend->write(dap, idx, USB_TIMEOUT);
 	if (retval < 0) {
 		queued_retval = retval;
@@ -833,6 +837,7 @@ static void cmsis_dap_swd_write_from_queue(struct cmsis_dap *dap)
 	} else {
 		queued_retval = ERROR_OK;
 	}
+	adapter_stats_transfer_done(start, idx, 0);
 
 	pending_fifo_put_idx = (pending_fifo_put_idx + 1) % dap->packet_count;
 	pending_fifo_block_count++;
@@ -853,6 +858,7 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 		LOG_ERROR("no pending write");
 
 	/* get reply */
+	int64_t start = adapter_stats_start();
 	int retval = dap->backend->read(dap, timeout_ms);
 	if (retval == ERROR_TIMEOUT_REACHED && timeout_ms < USB_TIMEOUT)
 		return;
@@ -862,6 +868,7 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 		queued_retval = ERROR_FAIL;
 		goto skip;
 	}
+	adapter_stats_transfer_done(start, 0, retval);
 
 	uint8_t *resp = dap->response;
 	if (resp[0] != CMD_DAP_TFER) {
@@ -879,6 +886,7 @@ static void cmsis_dap_swd_read_process(struct cmsis_dap *dap, int timeout_ms)
 		goto skip;
 	}
 	if (ack != SWD_ACK_OK) {
+		adapter_stats_swd_ack(ack);
 		LOG_DEBUG("SWD ack not OK @ %d %s", transfer_count,
 			  ack == SWD_ACK_WAIT ? "WAIT" : ack == SWD_ACK_FAULT ? "FAULT" : "JUNK");
 		queued_retval = ack == SWD_ACK_WAIT ? ERROR_WAIT : ERROR_FAIL;
@@ -70,6 +70,7 @@
 
 /* project specific includes */
 #include <jtag/adapter.h>
+#include <jtag/adapter_stats.h>
 #include <jtag/interface.h>
 #include <jtag/swd.h>
 #include <transport/transport.h>
@@ -1113,6 +1114,7 @@ static int ftdi_swd_run_queue(void)
 						1 + 3 + (swd_cmd_queue[i].cmd & SWD_CMD_RNW ? 0 : 1), 32));
 
 		if (ack != SWD_ACK_OK && check_ack) {
+			adapter_stats_swd_ack(ack);
 			queued_retval = swd_ack_to_error_code(ack);
 			goto skip;
 
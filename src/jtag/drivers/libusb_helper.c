@@ -25,6 +25,7 @@
 
 #include <helper/log.h>
 #include <jtag/adapter.h>
+#include <jtag/adapter_stats.h>
 #include "libusb_helper.h"
 
 /*
@@ -230,6 +231,7 @@ int jtag_libusb_control_transfer(struct libusb_device_handle *dev, uint8_t reque
 		uint16_t size, unsigned int timeout)
 {
 	int transferred = 0;
+	int64_t start = adapter_stats_start();
 
 	transferred = libusb_control_transfer(dev, request_type, request, value, index,
 				(unsigned char *)bytes, size, timeout);
@@ -237,6 +239,11 @@ int jtag_libusb_control_transfer(struct libusb_device_handle *dev, uint8_t reque
 	if (transferred < 0)
 		transferred = 0;
 
+	if (request_type & LIBUSB_ENDPOINT_IN)
+		adapter_stats_transfer_done(start, 0, transferred);
+	else
+		adapter_stats_transfer_done(start, transferred, 0);
+
 	return transferred;
 }
 
@@ -245,6 +252,8 @@ int jtag_libusb_bulk_write(struct libusb_device_handle *dev, int ep, char *bytes
 {
 	int ret;
 
+	int64_t start = adapter_stats_start();
+
 	*transferred = 0;
 
 	ret = libusb_bulk_transfer(dev, ep, (unsigned char *)bytes, size,
@@ -253,6 +262,7 @@ int jtag_libusb_bulk_write(struct libusb_device_handle *dev, int ep, char *bytes
 		LOG_ERROR("libusb_bulk_write error: %s", libusb_error_name(ret));
 		return jtag_libusb_error(ret);
 	}
+	adapter_stats_transfer_done(start, *transferred, 0);
 
 	return ERROR_OK;
 }
@@ -262,6 +272,8 @@ int jtag_libusb_bulk_read(struct libusb_device_handle *dev, int ep, char *bytes,
 {
 	int ret;
 
+	int64_t start = adapter_stats_start();
+
 	*transferred = 0;
 
 	ret = libusb_bulk_transfer(dev, ep, (unsigned char *)bytes, size,
@@ -270,6 +282,7 @@ int jtag_libusb_bulk_read(struct libusb_device_handle *dev, int ep, char *bytes,
 		LOG_ERROR("libusb_bulk_read error: %s", libusb_error_name(ret));
 		return jtag_libusb_error(ret);
 	}
+	adapter_stats_transfer_done(start, 0, *transferred);
 
 	return ERROR_OK;
 }
@@ -24,6 +24,7 @@
 #include "helper/log.h"
 #include "helper/replacements.h"
 #include "helper/time_support.h"
+#include "jtag/adapter_stats.h"
 #include <libusb.h>
 
 /* Compatibility define for older libusb-1.0 */
@@ -868,6 +869,7 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 		   immediately after processing the MPSSE commands in the write transaction */
 	}
 
+	int64_t stats_start = adapter_stats_start();
 	struct transfer_result write_result = { .ctx = ctx, .done = false };
 	struct libusb_transfer *write_transfer = libusb_alloc_transfer(0);
 	libusb_fill_bulk_transfer(write_transfer, ctx->usb_dev, ctx->out_ep, ctx->write_buffer,
@@ -919,6 +921,7 @@ int mpsse_flush(struct mpsse_ctx *ctx)
 			warn_after *= 2;
 		}
 	}
+	adapter_stats_transfer_done(stats_start, write_result.transferred, read_result.transferred);
 
 error_check:
 	if (retval != LIBUSB_SUCCESS) {
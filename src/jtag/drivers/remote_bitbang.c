@@ -27,6 +27,7 @@
 #endif
 #include "helper/system.h"
 #include "helper/replacements.h"
+#include <jtag/adapter_stats.h>
 #include <jtag/interface.h>
 #include "bitbang.h"
 
@@ -37,11 +38,11 @@ static char *remote_bitbang_host;
 static char *remote_bitbang_port;
 
 static int remote_bitbang_fd;
-static uint8_t remote_bitbang_send_buf[512];
+static uint8_t remote_bitbang_send_buf[4096];
 static unsigned int remote_bitbang_send_buf_used;
 
 /* Circular buffer. When start == end, the buffer is empty. */
-static char remote_bitbang_recv_buf[256];
+static char remote_bitbang_recv_buf[4096];
 static unsigned int remote_bitbang_recv_buf_start;
 static unsigned int remote_bitbang_recv_buf_end;
 
@@ -57,6 +58,28 @@ static bool remote_bitbang_recv_buf_empty(void)
 	return remote_bitbang_recv_buf_start == remote_bitbang_recv_buf_end;
 }
 
+/* Use the extended protocol: run-length coded clocks and whole SWD
+ * transactions, see doc/manual/jtag/drivers/remote_bitbang.txt */
+static bool remote_bitbang_extended;
+
+/* JTAG clock cycles not sent yet: a run of remote_bitbang_run_count
+ * identical cycles, then possibly a TCK low write waiting for its high */
+static int remote_bitbang_run_value = -1;
+static unsigned int remote_bitbang_run_count;
+static int remote_bitbang_low_value = -1;
+
+/* SWD transactions sent whose replies have not been read yet */
+#define REMOTE_BITBANG_SWD_QUEUE_SIZE	256
+
+struct remote_bitbang_swd_pending {
+	uint8_t cmd;
+	uint32_t *dst;
+};
+
+static struct remote_bitbang_swd_pending remote_bitbang_swd_queue[REMOTE_BITBANG_SWD_QUEUE_SIZE];
+static unsigned int remote_bitbang_swd_queue_len;
+static int remote_bitbang_swd_queued_retval;
+
 static unsigned int remote_bitbang_recv_buf_contiguous_available_space(void)
 {
 	if (remote_bitbang_recv_buf_end >= remote_bitbang_recv_buf_start) {
@@ -71,8 +94,13 @@ static unsigned int remote_bitbang_recv_buf_contiguous_available_space(void)
 	}
 }
 
+static int remote_bitbang_rle_flush(void);
+
 static int remote_bitbang_flush(void)
 {
+	if (remote_bitbang_rle_flush() != ERROR_OK)
+		return ERROR_FAIL;
+
 	if (remote_bitbang_send_buf_used <= 0)
 		return ERROR_OK;
 
@@ -150,11 +178,47 @@ typedef enum {
 	FLUSH_SEND_BUF
 } flush_bool_t;
 
-static int remote_bitbang_queue(int c, flush_bool_t flush)
+static int remote_bitbang_put(int c)
 {
 	remote_bitbang_send_buf[remote_bitbang_send_buf_used++] = c;
-	if (flush == FLUSH_SEND_BUF ||
-			remote_bitbang_send_buf_used >= ARRAY_SIZE(remote_bitbang_send_buf))
+	if (remote_bitbang_send_buf_used >= ARRAY_SIZE(remote_bitbang_send_buf))
+		return remote_bitbang_flush();
+	return ERROR_OK;
+}
+
+/* Send the JTAG clock cycles held back for run-length coding */
+static int remote_bitbang_rle_flush(void)
+{
+	int value = remote_bitbang_run_value;
+	unsigned int count = remote_bitbang_run_count;
+	int low = remote_bitbang_low_value;
+	int retval = ERROR_OK;
+
+	remote_bitbang_run_value = -1;
+	remote_bitbang_run_count = 0;
+	remote_bitbang_low_value = -1;
+
+	if (count >= 2) {
+		retval |= remote_bitbang_put('K');
+		retval |= remote_bitbang_put(count);
+		retval |= remote_bitbang_put('0' + value);
+	} else if (count == 1) {
+		retval |= remote_bitbang_put('0' + value);
+		retval |= remote_bitbang_put('4' + value);
+	}
+	if (low >= 0)
+		retval |= remote_bitbang_put('0' + low);
+
+	return retval == ERROR_OK ? ERROR_OK : ERROR_FAIL;
+}
+
+static int remote_bitbang_queue(int c, flush_bool_t flush)
+{
+	if (remote_bitbang_rle_flush() != ERROR_OK)
+		return ERROR_FAIL;
+	if (remote_bitbang_put(c) != ERROR_OK)
+		return ERROR_FAIL;
+	if (flush == FLUSH_SEND_BUF)
 		return remote_bitbang_flush();
 	return ERROR_OK;
 }
@@ -198,23 +262,64 @@ static int remote_bitbang_sample(void)
 	return remote_bitbang_queue('R', NO_FLUSH);
 }
 
-static bb_value_t remote_bitbang_read_sample(void)
+/* Return the next byte received, waiting for it if needed */
+static int remote_bitbang_read_byte(uint8_t *value)
 {
 	if (remote_bitbang_recv_buf_empty()) {
 		if (remote_bitbang_fill_buf(BLOCK) != ERROR_OK)
-			return BB_ERROR;
+			return ERROR_FAIL;
+		if (remote_bitbang_recv_buf_empty()) {
+			LOG_ERROR("remote_bitbang: connection closed by remote");
+			return ERROR_FAIL;
+		}
 	}
-	assert(!remote_bitbang_recv_buf_empty());
-	int c = remote_bitbang_recv_buf[remote_bitbang_recv_buf_start];
+	*value = remote_bitbang_recv_buf[remote_bitbang_recv_buf_start];
 	remote_bitbang_recv_buf_start =
 		(remote_bitbang_recv_buf_start + 1) % sizeof(remote_bitbang_recv_buf);
+	return ERROR_OK;
+}
+
+static bb_value_t remote_bitbang_read_sample(void)
+{
+	uint8_t c;
+
+	if (remote_bitbang_read_byte(&c) != ERROR_OK)
+		return BB_ERROR;
 	return char_to_int(c);
 }
 
 static int remote_bitbang_write(int tck, int tms, int tdi)
 {
-	char c = '0' + ((tck ? 0x4 : 0x0) | (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0));
-	return remote_bitbang_queue(c, NO_FLUSH);
+	int value = (tms ? 0x2 : 0x0) | (tdi ? 0x1 : 0x0);
+
+	if (!remote_bitbang_extended)
+		return remote_bitbang_queue('0' + ((tck ? 0x4 : 0x0) | value), NO_FLUSH);
+
+	/* Clock cycles are written as TCK low then high with the same TMS
+	 * and TDI; runs of identical cycles are sent as one 'K' request. */
+	if (!tck) {
+		if (remote_bitbang_low_value >= 0 ||
+				(remote_bitbang_run_value >= 0 && remote_bitbang_run_value != value)) {
+			if (remote_bitbang_rle_flush() != ERROR_OK)
+				return ERROR_FAIL;
+		}
+		remote_bitbang_low_value = value;
+		return ERROR_OK;
+	}
+
+	if (remote_bitbang_low_value == value) {
+		remote_bitbang_low_value = -1;
+		if (remote_bitbang_run_value == value && remote_bitbang_run_count < 255) {
+			remote_bitbang_run_count++;
+			return ERROR_OK;
+		}
+		int retval = remote_bitbang_rle_flush();
+		remote_bitbang_run_value = value;
+		remote_bitbang_run_count = 1;
+		return retval;
+	}
+
+	return remote_bitbang_queue('4' + value, NO_FLUSH);
 }
 
 static int remote_bitbang_reset(int trst, int srst)
@@ -231,12 +336,187 @@ static int remote_bitbang_blink(int on)
 	return remote_bitbang_queue(c, FLUSH_SEND_BUF);
 }
 
+static int remote_bitbang_swd_collect(void);
+
+static int remote_bitbang_swdio_read(void)
+{
+	/* replies to queued transactions come first */
+	if (remote_bitbang_swd_queue_len && remote_bitbang_swd_collect() != ERROR_OK)
+		return BB_ERROR;
+	if (remote_bitbang_fill_buf(NO_BLOCK) != ERROR_OK)
+		return BB_ERROR;
+	if (remote_bitbang_queue('c', FLUSH_SEND_BUF) != ERROR_OK)
+		return BB_ERROR;
+	return remote_bitbang_read_sample();
+}
+
+static void remote_bitbang_swdio_drive(bool is_output)
+{
+	char c = is_output ? 'O' : 'o';
+	if (remote_bitbang_queue(c, NO_FLUSH) != ERROR_OK)
+		LOG_ERROR("Error setting direction for swdio");
+}
+
+static int remote_bitbang_swd_write(int swclk, int swdio)
+{
+	char c = 'd' + ((swclk ? 0x2 : 0x0) | (swdio ? 0x1 : 0x0));
+	return remote_bitbang_queue(c, NO_FLUSH);
+}
+
 static struct bitbang_interface remote_bitbang_bitbang = {
 	.buf_size = sizeof(remote_bitbang_recv_buf) - 1,
 	.sample = &remote_bitbang_sample,
 	.read_sample = &remote_bitbang_read_sample,
 	.write = &remote_bitbang_write,
 	.blink = &remote_bitbang_blink,
+	.swdio_read = &remote_bitbang_swdio_read,
+	.swdio_drive = &remote_bitbang_swdio_drive,
+	.swd_write = &remote_bitbang_swd_write,
+};
+
+/* Read the replies to all SWD transactions sent so far */
+static int remote_bitbang_swd_collect(void)
+{
+	unsigned int count = remote_bitbang_swd_queue_len;
+
+	remote_bitbang_swd_queue_len = 0;
+	if (remote_bitbang_flush() != ERROR_OK)
+		return ERROR_FAIL;
+
+	for (unsigned int i = 0; i < count; i++) {
+		struct remote_bitbang_swd_pending *pending = &remote_bitbang_swd_queue[i];
+		bool rnw = pending->cmd & SWD_CMD_RNW;
+		uint8_t reply[5];
+
+		for (unsigned int j = 0; j < (rnw ? 5u : 1u); j++) {
+			if (remote_bitbang_read_byte(&reply[j]) != ERROR_OK) {
+				remote_bitbang_swd_queued_retval = ERROR_FAIL;
+				return ERROR_FAIL;
+			}
+		}
+
+		if (remote_bitbang_swd_queued_retval != ERROR_OK)
+			continue;
+
+		int ack = reply[0] & 0x7;
+		if (swd_cmd_returns_ack(pending->cmd) && ack != SWD_ACK_OK) {
+			LOG_DEBUG("%s %s reg %X failed, ack %d", rnw ? "read" : "write",
+				pending->cmd & SWD_CMD_APNDP ? "AP" : "DP",
+				(pending->cmd & SWD_CMD_A32) >> 1, ack);
+			adapter_stats_swd_ack(ack);
+			remote_bitbang_swd_queued_retval = swd_ack_to_error_code(ack);
+			continue;
+		}
+
+		if (rnw) {
+			uint32_t data = le_to_h_u32(reply + 1);
+			int parity = (reply[0] >> 3) & 1;
+
+			if (parity != parity_u32(data)) {
+				LOG_ERROR("Wrong parity detected");
+				remote_bitbang_swd_queued_retval = ERROR_FAIL;
+				continue;
+			}
+			if (pending->dst)
+				*pending->dst = data;
+		}
+	}
+
+	return ERROR_OK;
+}
+
+/* Queue one whole SWD transaction: 'X', request, data, idle cycles */
+static void remote_bitbang_swd_transaction(uint8_t cmd, uint32_t value, uint32_t *dst,
+		uint32_t ap_delay_clk)
+{
+	if (remote_bitbang_swd_queued_retval != ERROR_OK)
+		return;
+
+	if (remote_bitbang_swd_queue_len == REMOTE_BITBANG_SWD_QUEUE_SIZE &&
+			remote_bitbang_swd_collect() != ERROR_OK)
+		return;
+
+	uint8_t request[8];
+	uint32_t idle = (cmd & SWD_CMD_APNDP) ? MIN(ap_delay_clk, 0xffff) : 0;
+
+	cmd |= SWD_CMD_START | SWD_CMD_PARK;
+	request[0] = 'X';
+	request[1] = cmd;
+	h_u32_to_le(request + 2, value);
+	h_u16_to_le(request + 6, idle);
+
+	for (unsigned int i = 0; i < sizeof(request); i++) {
+		int retval = i ? remote_bitbang_put(request[i]) : remote_bitbang_queue(request[i], NO_FLUSH);
+		if (retval != ERROR_OK) {
+			remote_bitbang_swd_queued_retval = ERROR_FAIL;
+			return;
+		}
+	}
+
+	remote_bitbang_swd_queue[remote_bitbang_swd_queue_len].cmd = cmd;
+	remote_bitbang_swd_queue[remote_bitbang_swd_queue_len].dst = dst;
+	remote_bitbang_swd_queue_len++;
+}
+
+static int remote_bitbang_swd_init(void)
+{
+	return bitbang_swd.init();
+}
+
+static int remote_bitbang_swd_switch_seq(enum swd_special_seq seq)
+{
+	return bitbang_swd.switch_seq(seq);
+}
+
+static void remote_bitbang_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RNW);
+
+	if (!remote_bitbang_extended) {
+		bitbang_swd.read_reg(cmd, value, ap_delay_clk);
+		return;
+	}
+	remote_bitbang_swd_transaction(cmd, 0, value, ap_delay_clk);
+}
+
+static void remote_bitbang_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RNW));
+
+	if (!remote_bitbang_extended) {
+		bitbang_swd.write_reg(cmd, value, ap_delay_clk);
+		return;
+	}
+	remote_bitbang_swd_transaction(cmd, value, NULL, ap_delay_clk);
+}
+
+static int remote_bitbang_swd_run_queue(void)
+{
+	if (!remote_bitbang_extended)
+		return bitbang_swd.run();
+
+	/* A transaction must be followed by another transaction or at least 8 idle
+	 * cycles to ensure that data is clocked through the AP. */
+	for (unsigned int i = 0; i < 8; i++) {
+		remote_bitbang_swd_write(0, 0);
+		remote_bitbang_swd_write(1, 0);
+	}
+
+	/* one round trip for everything queued */
+	remote_bitbang_swd_collect();
+
+	int retval = remote_bitbang_swd_queued_retval;
+	remote_bitbang_swd_queued_retval = ERROR_OK;
+	LOG_DEBUG("SWD queue return value: %02x", retval);
+	return retval;
+}
+
+static const struct swd_driver remote_bitbang_swd = {
+	.init = remote_bitbang_swd_init,
+	.switch_seq = remote_bitbang_swd_switch_seq,
+	.read_reg = remote_bitbang_swd_read_reg,
+	.write_reg = remote_bitbang_swd_write_reg,
+	.run = remote_bitbang_swd_run_queue,
 };
 
 static int remote_bitbang_init_tcp(void)
@@ -350,6 +630,15 @@ COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_port_command)
 	return ERROR_COMMAND_SYNTAX_ERROR;
 }
 
+COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_extended_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ON_OFF(CMD_ARGV[0], remote_bitbang_extended);
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(remote_bitbang_handle_remote_bitbang_host_command)
 {
 	if (CMD_ARGC == 1) {
@@ -377,6 +666,14 @@ static const struct command_registration remote_bitbang_subcommand_handlers[] =
 			"  if port is 0 or unset, this is the name of the unix socket to use.",
 		.usage = "host_name",
 	},
+	{
+		.name = "extended",
+		.handler = remote_bitbang_handle_remote_bitbang_extended_command,
+		.mode = COMMAND_CONFIG,
+		.help = "Use the extended protocol with run-length coded clocks\n"
+			"  and whole SWD transactions; the remote end must support it.",
+		.usage = "(on|off)",
+	},
 	COMMAND_REGISTRATION_DONE,
 };
 
@@ -410,9 +707,11 @@ static struct jtag_interface remote_bitbang_interface = {
 	.execute_queue = &remote_bitbang_execute_queue,
 };
 
+static const char * const remote_bitbang_transports[] = { "jtag", "swd", NULL };
+
 struct adapter_driver remote_bitbang_adapter_driver = {
 	.name = "remote_bitbang",
-	.transports = jtag_only,
+	.transports = remote_bitbang_transports,
 	.commands = remote_bitbang_command_handlers,
 
 	.init = &remote_bitbang_init,
@@ -420,4 +719,5 @@ struct adapter_driver remote_bitbang_adapter_driver = {
 	.reset = &remote_bitbang_reset,
 
 	.jtag_ops = &remote_bitbang_interface,
+	.swd_ops = &remote_bitbang_swd,
 };
@@ -0,0 +1,867 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/time_support.h>
+#include <jtag/adapter_stats.h>
+#include <jtag/interface.h>
+#include <jtag/swd.h>
+#include <target/arm_adi_v5.h>
+#include <target/cortex_m.h>
+
+/*
+ * Simulated SWD target.
+ *
+ * Instead of talking to hardware, this driver answers SWD transactions
+ * from a software model of a HC32L110: an ADIv5 SW-DP, one AHB MEM-AP
+ * over host memory, the Cortex-M0+ debug registers needed to halt, step
+ * and access core registers, and the HC32L110 flash controller. The core
+ * does not execute code; it only changes state when the debugger tells
+ * it to. This is enough to run the memory, flash and GDB paths of OpenOCD
+ * without hardware, e.g. in CI or for benchmarking.
+ *
+ * The cost of a real adapter can be injected: every queue flush sleeps for
+ * a fixed round-trip time plus a per-transaction cost.
+ */
+
+#define SIM_DPIDR			0x0BC11477	/* SW-DP, DPv1, Cortex-M0+ */
+#define SIM_AP_IDR			0x04770031	/* AHB-AP, Cortex-M0+ */
+#define SIM_ROM_TABLE		0xE00FF000
+#define SIM_CPUID			0x410CC601	/* Cortex-M0+ r0p1 */
+
+#define SIM_FLASH_BASE		0x00000000
+#define SIM_FLASH_MAX_SIZE	0x8000
+#define SIM_FLASH_SECTOR	512
+#define SIM_FLASH_SLOCK_SEC	4096
+#define SIM_FLASH_SIZE_REG	0x00100C70
+#define SIM_SRAM_BASE		0x20000000
+#define SIM_FLASH_CTRL_BASE	0x40020000
+#define SIM_DWT_BASE		0xE0001000
+#define SIM_FPB_BASE		0xE0002000
+#define SIM_SCS_BASE		0xE000E000
+
+/* offsets in the flash controller */
+#define SIM_FLASH_CR		0x20
+#define SIM_FLASH_BYPASS	0x2C
+#define SIM_FLASH_SLOCK		0x30
+
+#define SIM_FLASH_CR_OP		0x3
+#define SIM_FLASH_CR_BUSY	(1 << 4)
+
+#define SIM_FLASH_OP_PROGRAM		1
+#define SIM_FLASH_OP_ERASE_SECTOR	2
+#define SIM_FLASH_OP_ERASE_CHIP		3
+
+struct sim_region {
+	uint32_t start;
+	uint32_t size;
+	uint8_t *mem;
+	/* offset is word aligned, mask selects the byte lanes written */
+	uint32_t (*read)(struct sim_region *region, uint32_t offset);
+	void (*write)(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask);
+};
+
+/* configuration */
+static uint32_t sim_flash_size = SIM_FLASH_MAX_SIZE;
+static uint32_t sim_sram_size = 4096;
+static unsigned int sim_program_us = 8;
+static unsigned int sim_sector_erase_us = 5000;
+static unsigned int sim_chip_erase_us = 35000;
+static unsigned int sim_latency_us;
+static unsigned int sim_transaction_ns;
+
+/* debug port */
+static uint32_t sim_ctrl_stat;
+static uint32_t sim_select;
+static uint32_t sim_rdbuff;
+static int queued_retval;
+static unsigned int sim_queued_transactions;
+
+/* memory access port */
+static uint32_t sim_csw;
+static uint32_t sim_tar;
+
+/* flash controller */
+static uint32_t sim_flash_cr;
+static uint32_t sim_flash_slock;
+static unsigned int sim_flash_bypass;	/* 0, 1 after 0x5a5a, 2 after 0xa5a5 */
+static int64_t sim_flash_busy_until;
+
+/* core */
+static uint32_t sim_core_regs[0x80];	/* indexed by DCRSR REGSEL */
+static uint32_t sim_dhcsr;				/* C_* bits */
+static bool sim_halted;
+static bool sim_reset_st;
+
+static uint8_t *sim_flash;
+static uint8_t *sim_sram;
+static uint8_t sim_flash_ctrl[0x400];
+static uint8_t sim_scs[0x1000];
+static uint8_t sim_dwt[0x1000];
+static uint8_t sim_fpb[0x1000];
+
+static int64_t sim_time_us(void)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+}
+
+static uint32_t sim_mem_read(struct sim_region *region, uint32_t offset)
+{
+	return le_to_h_u32(region->mem + offset);
+}
+
+static void sim_mem_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+	uint32_t old = le_to_h_u32(region->mem + offset);
+
+	h_u32_to_le(region->mem + offset, (old & ~mask) | (value & mask));
+}
+
+static bool sim_flash_unlocked(uint32_t offset)
+{
+	return sim_flash_slock & (1 << (offset / SIM_FLASH_SLOCK_SEC));
+}
+
+/* Any write to the flash array starts the operation selected in FLASH_CR. */
+static void sim_flash_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+	int64_t now = sim_time_us();
+
+	if (now < sim_flash_busy_until) {
+		LOG_DEBUG("sim: flash write at 0x%" PRIx32 " while busy, ignored", offset);
+		return;
+	}
+
+	switch (sim_flash_cr & SIM_FLASH_CR_OP) {
+		case SIM_FLASH_OP_PROGRAM:
+			if (!sim_flash_unlocked(offset))
+				break;
+			/* programming can only clear bits */
+			h_u32_to_le(region->mem + offset,
+				le_to_h_u32(region->mem + offset) & (value | ~mask));
+			sim_flash_busy_until = now + sim_program_us;
+			break;
+		case SIM_FLASH_OP_ERASE_SECTOR:
+			if (!sim_flash_unlocked(offset))
+				break;
+			memset(region->mem + (offset & ~(SIM_FLASH_SECTOR - 1)), 0xff, SIM_FLASH_SECTOR);
+			sim_flash_busy_until = now + sim_sector_erase_us;
+			break;
+		case SIM_FLASH_OP_ERASE_CHIP:
+			memset(region->mem, 0xff, region->size);
+			sim_flash_busy_until = now + sim_chip_erase_us;
+			break;
+		default:
+			LOG_DEBUG("sim: flash write at 0x%" PRIx32 " in read mode, ignored", offset);
+			break;
+	}
+}
+
+static uint32_t sim_flash_size_read(struct sim_region *region, uint32_t offset)
+{
+	return sim_flash_size;
+}
+
+static uint32_t sim_flash_ctrl_read(struct sim_region *region, uint32_t offset)
+{
+	switch (offset) {
+		case SIM_FLASH_CR:
+			if (sim_time_us() < sim_flash_busy_until)
+				return sim_flash_cr | SIM_FLASH_CR_BUSY;
+			return sim_flash_cr;
+		case SIM_FLASH_BYPASS:
+			return 0;
+		case SIM_FLASH_SLOCK:
+			return sim_flash_slock;
+		default:
+			return sim_mem_read(region, offset);
+	}
+}
+
+/* FLASH_CR and SLOCK only accept a write right after the 0x5a5a, 0xa5a5
+ * sequence has been written to BYPASS. */
+static void sim_flash_ctrl_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+	bool bypassed = sim_flash_bypass == 2;
+
+	switch (offset) {
+		case SIM_FLASH_BYPASS:
+			if ((value & 0xffff) == 0x5a5a)
+				sim_flash_bypass = 1;
+			else if ((value & 0xffff) == 0xa5a5 && sim_flash_bypass == 1)
+				sim_flash_bypass = 2;
+			else
+				sim_flash_bypass = 0;
+			return;
+		case SIM_FLASH_CR:
+			sim_flash_bypass = 0;
+			if (!bypassed || sim_time_us() < sim_flash_busy_until) {
+				LOG_DEBUG("sim: FLASH_CR write ignored");
+				return;
+			}
+			sim_flash_cr = (sim_flash_cr & ~mask) | (value & mask & ~SIM_FLASH_CR_BUSY);
+			return;
+		case SIM_FLASH_SLOCK:
+			sim_flash_bypass = 0;
+			if (!bypassed) {
+				LOG_DEBUG("sim: FLASH_SLOCK write ignored");
+				return;
+			}
+			sim_flash_slock = (sim_flash_slock & ~mask) | (value & mask);
+			return;
+		default:
+			sim_mem_write(region, offset, value, mask);
+			return;
+	}
+}
+
+static void sim_halt(uint32_t reason)
+{
+	uint8_t *dfsr = sim_scs + (NVIC_DFSR - SIM_SCS_BASE);
+
+	sim_halted = true;
+	h_u32_to_le(dfsr, le_to_h_u32(dfsr) | reason);
+}
+
+/* Reset of everything but the debug logic: the flash controller locks
+ * again and the core loads SP and PC from the vector table. */
+static void sim_system_reset(void)
+{
+	uint32_t demcr = le_to_h_u32(sim_scs + (DCB_DEMCR - SIM_SCS_BASE));
+
+	LOG_DEBUG("sim: system reset");
+
+	sim_flash_cr = 0;
+	sim_flash_slock = 0;
+	sim_flash_bypass = 0;
+	sim_flash_busy_until = 0;
+
+	memset(sim_core_regs, 0, sizeof(sim_core_regs));
+	sim_core_regs[13] = le_to_h_u32(sim_flash) & ~3;
+	sim_core_regs[15] = le_to_h_u32(sim_flash + 4) & ~1;
+	sim_core_regs[16] = 0x01000000;		/* xPSR, Thumb bit */
+	sim_reset_st = true;
+
+	sim_halted = false;
+	if ((sim_dhcsr & C_DEBUGEN) && (demcr & VC_CORERESET))
+		sim_halt(DFSR_VCATCH);
+}
+
+static uint32_t sim_scs_read(struct sim_region *region, uint32_t offset)
+{
+	uint32_t value;
+
+	switch (region->start + offset) {
+		case CPUID:
+			return SIM_CPUID;
+		case NVIC_AIRCR:
+			return 0xFA050000;
+		case DCB_DHCSR:
+			value = sim_dhcsr | S_REGRDY;
+			value |= sim_halted ? S_HALT : S_RETIRE_ST;
+			if (sim_reset_st)
+				value |= S_RESET_ST;
+			sim_reset_st = false;
+			return value;
+		default:
+			return sim_mem_read(region, offset);
+	}
+}
+
+static void sim_scs_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+	uint32_t address = region->start + offset;
+	unsigned int regsel;
+
+	switch (address) {
+		case CPUID:
+			return;
+		case NVIC_AIRCR:
+			if ((value & 0xffff0000) != AIRCR_VECTKEY)
+				return;
+			if (value & (AIRCR_SYSRESETREQ | AIRCR_VECTRESET))
+				sim_system_reset();
+			return;
+		case NVIC_DFSR:
+			/* write one to clear */
+			sim_mem_write(region, offset, 0, value & mask);
+			return;
+		case DCB_DHCSR:
+			if ((value & 0xffff0000) != DBGKEY)
+				return;
+			sim_dhcsr = value & (C_DEBUGEN | C_HALT | C_STEP | C_MASKINTS);
+			if (!(sim_dhcsr & C_DEBUGEN)) {
+				sim_halted = false;
+			} else if (sim_dhcsr & C_HALT) {
+				if (!sim_halted)
+					sim_halt(DFSR_HALTED);
+			} else if (sim_dhcsr & C_STEP) {
+				/* there is no instruction set simulator; a step just
+				 * moves the PC past one 16-bit instruction */
+				sim_core_regs[15] += 2;
+				sim_halt(DFSR_HALTED);
+			} else {
+				sim_halted = false;
+			}
+			return;
+		case DCB_DCRSR:
+			regsel = value & 0x7f;
+			if (value & DCRSR_WNR)
+				sim_core_regs[regsel] = le_to_h_u32(region->mem + (DCB_DCRDR - region->start));
+			else
+				h_u32_to_le(region->mem + (DCB_DCRDR - region->start), sim_core_regs[regsel]);
+			return;
+		default:
+			sim_mem_write(region, offset, value, mask);
+			return;
+	}
+}
+
+static uint32_t sim_fpb_read(struct sim_region *region, uint32_t offset)
+{
+	uint32_t value = sim_mem_read(region, offset);
+
+	/* FP_CTRL: four code comparators, no literal comparators */
+	if (offset == 0)
+		return (value & 1) | 0x40;
+	return value;
+}
+
+static void sim_fpb_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+	/* FP_CTRL.ENABLE only changes if KEY is set */
+	if (offset == 0 && !(value & 2))
+		return;
+	sim_mem_write(region, offset, value, mask);
+}
+
+static uint32_t sim_dwt_read(struct sim_region *region, uint32_t offset)
+{
+	/* DWT_CTRL: two comparators */
+	if (offset == 0)
+		return 0x20000000;
+	return sim_mem_read(region, offset);
+}
+
+static uint32_t sim_rom_read(struct sim_region *region, uint32_t offset)
+{
+	static const uint32_t entries[] = {
+		0xFFF0F003,		/* SCS */
+		0xFFF02003,		/* DWT */
+		0xFFF03003,		/* FPB */
+		0,
+	};
+	static const uint32_t ids[] = {
+		0x000000C0, 0x000000B4, 0x0000000B, 0x00000000,	/* PID0..3 */
+		0x0000000D, 0x00000010, 0x00000005, 0x000000B1,	/* CID0..3 */
+	};
+
+	if (offset < sizeof(entries))
+		return entries[offset / 4];
+	if (offset >= 0xFE0)
+		return ids[(offset - 0xFE0) / 4];
+	if (offset == 0xFD0)
+		return 0x00000004;	/* PID4 */
+	return 0;
+}
+
+static void sim_ignore_write(struct sim_region *region, uint32_t offset, uint32_t value, uint32_t mask)
+{
+}
+
+static struct sim_region sim_regions[] = {
+	{ SIM_FLASH_BASE, 0, NULL, sim_mem_read, sim_flash_write },
+	{ SIM_FLASH_SIZE_REG, 4, NULL, sim_flash_size_read, sim_ignore_write },
+	{ SIM_SRAM_BASE, 0, NULL, sim_mem_read, sim_mem_write },
+	{ SIM_FLASH_CTRL_BASE, 0x400, NULL, sim_flash_ctrl_read, sim_flash_ctrl_write },
+	{ SIM_DWT_BASE, sizeof(sim_dwt), sim_dwt, sim_dwt_read, sim_mem_write },
+	{ SIM_FPB_BASE, sizeof(sim_fpb), sim_fpb, sim_fpb_read, sim_fpb_write },
+	{ SIM_SCS_BASE, sizeof(sim_scs), sim_scs, sim_scs_read, sim_scs_write },
+	{ SIM_ROM_TABLE, 0x1000, NULL, sim_rom_read, sim_ignore_write },
+};
+
+static struct sim_region *sim_find_region(uint32_t address)
+{
+	for (unsigned int i = 0; i < ARRAY_SIZE(sim_regions); i++) {
+		if (address - sim_regions[i].start < sim_regions[i].size)
+			return &sim_regions[i];
+	}
+	return NULL;
+}
+
+/* Bus access as seen by the MEM-AP: data is on the byte lanes selected by
+ * the low address bits. Returns false on a bus error. */
+static bool sim_bus_access(bool is_read, uint32_t address, unsigned int size, uint32_t *data)
+{
+	struct sim_region *region = sim_find_region(address);
+
+	if (!region || (address & (size - 1))) {
+		LOG_DEBUG("sim: bus error at 0x%08" PRIx32, address);
+		return false;
+	}
+
+	uint32_t offset = (address - region->start) & ~3;
+	if (is_read) {
+		*data = region->read(region, offset);
+	} else {
+		uint32_t mask = (size == 4 ? 0xffffffff : (1u << (8 * size)) - 1) << (8 * (address & 3));
+		region->write(region, offset, *data, mask);
+	}
+	return true;
+}
+
+static void sim_tar_increment(void)
+{
+	/* auto-increment only wraps within a 1 KiB block, like real MEM-APs */
+	uint32_t size = 1 << (sim_csw & CSW_SIZE_MASK);
+
+	sim_tar = (sim_tar & ~0x3ff) | ((sim_tar + size) & 0x3ff);
+}
+
+static int sim_ap_access(bool is_read, unsigned int reg, uint32_t *data)
+{
+	unsigned int ap = sim_select >> 24;
+	bool ok = true;
+
+	/* only AP 0 exists, other APs read as zero */
+	if (ap != 0) {
+		if (is_read)
+			*data = 0;
+		return SWD_ACK_OK;
+	}
+
+	switch (reg) {
+		case MEM_AP_REG_CSW:
+			if (is_read) {
+				*data = sim_csw | CSW_DEVICE_EN;
+			} else {
+				sim_csw = *data & ~(CSW_DEVICE_EN | CSW_TRIN_PROG);
+				/* no packed transfers, no sizes above 32 bits */
+				if ((sim_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_PACKED)
+					sim_csw &= ~CSW_ADDRINC_MASK;
+				if ((sim_csw & CSW_SIZE_MASK) > CSW_32BIT)
+					sim_csw = (sim_csw & ~CSW_SIZE_MASK) | CSW_32BIT;
+			}
+			break;
+		case MEM_AP_REG_TAR:
+			if (is_read)
+				*data = sim_tar;
+			else
+				sim_tar = *data;
+			break;
+		case MEM_AP_REG_DRW:
+			ok = sim_bus_access(is_read, sim_tar, 1 << (sim_csw & CSW_SIZE_MASK), data);
+			if (ok && (sim_csw & CSW_ADDRINC_MASK) == CSW_ADDRINC_SINGLE)
+				sim_tar_increment();
+			break;
+		case MEM_AP_REG_BD0:
+		case MEM_AP_REG_BD1:
+		case MEM_AP_REG_BD2:
+		case MEM_AP_REG_BD3:
+			ok = sim_bus_access(is_read, (sim_tar & ~0xf) | (reg & 0xc), 4, data);
+			break;
+		case MEM_AP_REG_BASE:
+			if (is_read)
+				*data = SIM_ROM_TABLE | 3;
+			break;
+		case AP_REG_IDR:
+			if (is_read)
+				*data = SIM_AP_IDR;
+			break;
+		default:
+			if (is_read)
+				*data = 0;
+			break;
+	}
+
+	if (!ok) {
+		/* The error is reported on the failing access itself rather than
+		 * on the next one, so it always reaches the caller of dap_run(). */
+		sim_ctrl_stat |= SSTICKYERR;
+		return SWD_ACK_FAULT;
+	}
+	return SWD_ACK_OK;
+}
+
+static int sim_dp_access(bool is_read, unsigned int reg, uint32_t *data)
+{
+	switch (reg) {
+		case 0x0:
+			if (is_read) {
+				*data = SIM_DPIDR;
+			} else {
+				if (*data & STKERRCLR)
+					sim_ctrl_stat &= ~SSTICKYERR;
+				if (*data & STKCMPCLR)
+					sim_ctrl_stat &= ~SSTICKYCMP;
+				if (*data & ORUNERRCLR)
+					sim_ctrl_stat &= ~SSTICKYORUN;
+			}
+			break;
+		case 0x4:
+			if (sim_select & DP_SELECT_DPBANK) {
+				if (is_read)
+					*data = 0;
+				break;
+			}
+			if (is_read) {
+				*data = sim_ctrl_stat;
+				/* power domains come up instantly */
+				if (sim_ctrl_stat & CDBGPWRUPREQ)
+					*data |= CDBGPWRUPACK;
+				if (sim_ctrl_stat & CSYSPWRUPREQ)
+					*data |= CSYSPWRUPACK;
+			} else {
+				sim_ctrl_stat = (sim_ctrl_stat & (SSTICKYERR | SSTICKYCMP | SSTICKYORUN))
+					| (*data & (CORUNDETECT | CDBGPWRUPREQ | CSYSPWRUPREQ));
+			}
+			break;
+		case 0x8:
+			if (is_read)
+				*data = sim_rdbuff;		/* RESEND */
+			else
+				sim_select = *data;
+			break;
+		case 0xC:
+			if (is_read)
+				*data = sim_rdbuff;		/* RDBUFF */
+			break;						/* TARGETSEL is ignored */
+	}
+	return SWD_ACK_OK;
+}
+
+static int sim_transfer(uint8_t cmd, bool is_read, uint32_t *data)
+{
+	unsigned int reg = (cmd & SWD_CMD_A32) >> 1;
+
+	sim_queued_transactions++;
+
+	if (!(cmd & SWD_CMD_APNDP))
+		return sim_dp_access(is_read, reg, data);
+
+	if (sim_ctrl_stat & SSTICKYERR)
+		return SWD_ACK_FAULT;
+
+	reg |= sim_select & DP_SELECT_APBANK;
+	if (!is_read)
+		return sim_ap_access(false, reg, data);
+
+	/* AP reads are posted: the data phase carries the result of the
+	 * previous AP read, this one is only available from RDBUFF */
+	uint32_t result;
+	int ack = sim_ap_access(true, reg, &result);
+	if (ack == SWD_ACK_OK) {
+		*data = sim_rdbuff;
+		sim_rdbuff = result;
+	}
+	return ack;
+}
+
+static int sim_swd_init(void)
+{
+	return ERROR_OK;
+}
+
+static int sim_swd_switch_seq(enum swd_special_seq seq)
+{
+	switch (seq) {
+		case LINE_RESET:
+		case JTAG_TO_SWD:
+		case DORMANT_TO_SWD:
+			LOG_DEBUG("sim: %s", seq == LINE_RESET ? "line reset" : "switch to SWD");
+			break;
+		case SWD_TO_JTAG:
+		case SWD_TO_DORMANT:
+		case JTAG_TO_DORMANT:
+			LOG_DEBUG("sim: leaving SWD");
+			break;
+		default:
+			LOG_ERROR("Sequence %d not supported", seq);
+			return ERROR_FAIL;
+	}
+	return ERROR_OK;
+}
+
+static void sim_swd_read_reg(uint8_t cmd, uint32_t *value, uint32_t ap_delay_clk)
+{
+	assert(cmd & SWD_CMD_RNW);
+
+	if (queued_retval != ERROR_OK)
+		return;
+
+	uint32_t data;
+	int ack = sim_transfer(cmd, true, &data);
+
+	LOG_DEBUG_IO("%s %s read reg %X = %08" PRIx32,
+			ack == SWD_ACK_OK ? "OK" : "FAULT",
+			cmd & SWD_CMD_APNDP ? "AP" : "DP",
+			(cmd & SWD_CMD_A32) >> 1, data);
+
+	if (ack != SWD_ACK_OK) {
+		adapter_stats_swd_ack(ack);
+		queued_retval = swd_ack_to_error_code(ack);
+		return;
+	}
+	if (value)
+		*value = data;
+}
+
+static void sim_swd_write_reg(uint8_t cmd, uint32_t value, uint32_t ap_delay_clk)
+{
+	assert(!(cmd & SWD_CMD_RNW));
+
+	if (queued_retval != ERROR_OK)
+		return;
+
+	int ack = sim_transfer(cmd, false, &value);
+
+	LOG_DEBUG_IO("%s %s write reg %X = %08" PRIx32,
+			ack == SWD_ACK_OK ? "OK" : "FAULT",
+			cmd & SWD_CMD_APNDP ? "AP" : "DP",
+			(cmd & SWD_CMD_A32) >> 1, value);
+
+	if (ack != SWD_ACK_OK) {
+		adapter_stats_swd_ack(ack);
+		queued_retval = swd_ack_to_error_code(ack);
+	}
+}
+
+static int sim_swd_run_queue(void)
+{
+	uint64_t delay_us = sim_latency_us
+		+ (uint64_t)sim_queued_transactions * sim_transaction_ns / 1000;
+
+	if (delay_us)
+		jtag_sleep(delay_us);
+	sim_queued_transactions = 0;
+
+	int retval = queued_retval;
+	queued_retval = ERROR_OK;
+	return retval;
+}
+
+static const struct swd_driver sim_swd = {
+	.init = sim_swd_init,
+	.switch_seq = sim_swd_switch_seq,
+	.read_reg = sim_swd_read_reg,
+	.write_reg = sim_swd_write_reg,
+	.run = sim_swd_run_queue,
+};
+
+/* CoreSight PIDR/CIDR of a system control component with part number @a part */
+static void sim_set_component_id(uint8_t *component, uint32_t part)
+{
+	static const uint32_t id[] = {
+		0x04, 0, 0, 0,			/* PID4..7 */
+		0, 0xB0, 0x0B, 0,		/* PID0..3, PID0 holds the part number */
+		0x0D, 0xE0, 0x05, 0xB1,	/* CID0..3 */
+	};
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(id); i++)
+		h_u32_to_le(component + 0xFD0 + 4 * i, id[i]);
+	h_u32_to_le(component + 0xFE0, part & 0xff);
+	h_u32_to_le(component + 0xFE4, 0xB0 | (part >> 8));
+}
+
+static int sim_init(void)
+{
+	sim_flash = malloc(sim_flash_size);
+	sim_sram = calloc(1, sim_sram_size);
+	if (!sim_flash || !sim_sram) {
+		LOG_ERROR("Out of memory");
+		free(sim_flash);
+		free(sim_sram);
+		sim_flash = NULL;
+		sim_sram = NULL;
+		return ERROR_FAIL;
+	}
+	memset(sim_flash, 0xff, sim_flash_size);
+
+	for (unsigned int i = 0; i < ARRAY_SIZE(sim_regions); i++) {
+		struct sim_region *region = &sim_regions[i];
+
+		switch (region->start) {
+			case SIM_FLASH_BASE:
+				region->mem = sim_flash;
+				region->size = sim_flash_size;
+				break;
+			case SIM_SRAM_BASE:
+				region->mem = sim_sram;
+				region->size = sim_sram_size;
+				break;
+			case SIM_FLASH_CTRL_BASE:
+				region->mem = sim_flash_ctrl;
+				break;
+		}
+	}
+
+	sim_set_component_id(sim_scs, 0x008);
+	sim_set_component_id(sim_dwt, 0x00A);
+	sim_set_component_id(sim_fpb, 0x00B);
+
+	sim_system_reset();
+
+	LOG_INFO("Simulated HC32L110, %" PRIu32 " KiB flash, %" PRIu32 " bytes SRAM",
+			sim_flash_size / 1024, sim_sram_size);
+	return ERROR_OK;
+}
+
+static int sim_quit(void)
+{
+	free(sim_flash);
+	free(sim_sram);
+	sim_flash = NULL;
+	sim_sram = NULL;
+	return ERROR_OK;
+}
+
+static int sim_reset(int trst, int srst)
+{
+	if (srst)
+		sim_system_reset();
+	return ERROR_OK;
+}
+
+static int sim_speed(int speed)
+{
+	return ERROR_OK;
+}
+
+static int sim_khz(int khz, int *jtag_speed)
+{
+	*jtag_speed = khz;
+	return ERROR_OK;
+}
+
+static int sim_speed_div(int speed, int *khz)
+{
+	*khz = speed;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(sim_handle_latency_command)
+{
+	if (CMD_ARGC > 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC > 0)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], sim_latency_us);
+	if (CMD_ARGC > 1)
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], sim_transaction_ns);
+
+	command_print(CMD, "%u us per queue flush, %u ns per transaction",
+			sim_latency_us, sim_transaction_ns);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(sim_handle_memory_command)
+{
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	uint32_t flash_size, sram_size;
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], flash_size);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], sram_size);
+
+	if (flash_size < SIM_FLASH_SLOCK_SEC || flash_size > SIM_FLASH_MAX_SIZE
+			|| flash_size % SIM_FLASH_SLOCK_SEC) {
+		command_print(CMD, "flash size must be a multiple of 4 KiB up to 32 KiB");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	if (sram_size == 0 || sram_size % 4 || sram_size > 0x10000000) {
+		command_print(CMD, "invalid SRAM size");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	sim_flash_size = flash_size;
+	sim_sram_size = sram_size;
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(sim_handle_flash_timing_command)
+{
+	if (CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	unsigned int program_us, sector_erase_us, chip_erase_us;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], program_us);
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], sector_erase_us);
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], chip_erase_us);
+
+	sim_program_us = program_us;
+	sim_sector_erase_us = sector_erase_us;
+	sim_chip_erase_us = chip_erase_us;
+	return ERROR_OK;
+}
+
+static const struct command_registration sim_subcommand_handlers[] = {
+	{
+		.name = "latency",
+		.handler = sim_handle_latency_command,
+		.mode = COMMAND_ANY,
+		.help = "set the simulated adapter round-trip time per queue flush "
+			"and the cost of each SWD transaction",
+		.usage = "[round_trip_us [transaction_ns]]",
+	},
+	{
+		.name = "memory",
+		.handler = sim_handle_memory_command,
+		.mode = COMMAND_CONFIG,
+		.help = "set the size of the simulated flash and SRAM",
+		.usage = "flash_bytes sram_bytes",
+	},
+	{
+		.name = "flash_timing",
+		.handler = sim_handle_flash_timing_command,
+		.mode = COMMAND_ANY,
+		.help = "set how long the flash controller stays busy",
+		.usage = "program_us sector_erase_us chip_erase_us",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration sim_command_handlers[] = {
+	{
+		.name = "sim",
+		.mode = COMMAND_ANY,
+		.help = "simulated target commands",
+		.chain = sim_subcommand_handlers,
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const char * const sim_transports[] = { "swd", NULL };
+
+struct adapter_driver sim_adapter_driver = {
+	.name = "sim",
+	.transports = sim_transports,
+	.commands = sim_command_handlers,
+
+	.init = &sim_init,
+	.quit = &sim_quit,
+	.reset = &sim_reset,
+	.speed = &sim_speed,
+	.khz = &sim_khz,
+	.speed_div = &sim_speed_div,
+
+	.swd_ops = &sim_swd,
+};
@@ -532,6 +532,9 @@ void jtag_execute_queue_noclear(void);
 /** @returns the number of times the scan queue has been flushed */
 int jtag_get_flush_queue_count(void);
 
+/** Count a flush of an adapter queue that is not a JTAG scan queue, e.g. SWD */
+void jtag_count_flush(void);
+
 /** Report Tcl event to all TAPs */
 void jtag_notify_event(enum jtag_event);
 
@@ -43,6 +43,7 @@
 #include <server/server.h>
 #include <server/gdb_server.h>
 #include <server/rtt_server.h>
+#include <server/sample_server.h>
 
 #ifdef HAVE_STRINGS_H
 #include <strings.h>
@@ -311,6 +312,7 @@ static struct command_context *setup_command_handler(Jim_Interp *interp)
 		&gdb_register_commands,
 		&log_register_commands,
 		&rtt_server_register_commands,
+		&sample_server_register_commands,
 		&transport_register_commands,
 		&adapter_register_commands,
 		&target_register_commands,
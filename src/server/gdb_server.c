@@ -43,12 +43,15 @@
 #include <target/register.h>
 #include <target/target.h>
 #include <target/target_type.h>
+#include <target/memory_cache.h>
 #include <target/semihosting_common.h>
 #include "server.h"
+#include "read_scheduler.h"
 #include <flash/nor/core.h>
 #include "gdb_server.h"
 #include <target/image.h>
 #include <jtag/jtag.h>
+#include <jtag/adapter_stats.h>
 #include "rtos/rtos.h"
 #include "target/smp.h"
 
@@ -67,6 +70,28 @@ struct target_desc_format {
 };
 
 /* private connection data for GDB */
+/* largest flash bank copied to the host to answer qCRC packets */
+#define GDB_CRC_REGION_MAX	(256 * 1024)
+/* number of target calculated qCRC results remembered */
+#define GDB_CRC_RESULTS		16
+
+/* qCRC answers valid for one halt, see gdb_crc_memory() */
+struct gdb_crc_cache {
+	struct target *target;
+	unsigned int epoch;
+	bool region_tried;
+	target_addr_t region_address;
+	uint32_t region_size;
+	uint8_t *region;
+	struct {
+		target_addr_t address;
+		uint32_t size;
+		uint32_t crc;
+	} results[GDB_CRC_RESULTS];
+	unsigned int num_results;
+	unsigned int next_result;
+};
+
 struct gdb_connection {
 	char buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
 	char *buf_p;
@@ -93,10 +118,27 @@ struct gdb_connection {
 	bool attached;
 	/* set when extended protocol is used */
 	bool extended_protocol;
+	/* set by QNonStop:1, stop replies are then sent as %Stop notifications */
+	bool non_stop;
+	/* the target was stopped by vCont;t, which is reported with signal 0 */
+	bool stop_requested;
 	/* temporarily used for target description support */
 	struct target_desc_format target_desc;
 	/* temporarily used for thread list support */
 	char *thread_list;
+	/* largest packet accepted from gdb, as advertised in qSupported */
+	unsigned int packet_size;
+	char *packet_buffer;
+	/* reusable buffer for packet handlers, see gdb_scratch() */
+	void *scratch;
+	size_t scratch_size;
+	struct gdb_crc_cache crc_cache;
+	/* set while another connection controls the target, see gdb_claim_control() */
+	bool observer;
+	/* packet type of the read waiting in the read scheduler */
+	bool read_binary;
+	/* input is handled from server_yield(), see gdb_yield_input() */
+	bool yielding;
 };
 
 #if 0
@@ -145,6 +187,11 @@ static int gdb_use_target_description = 1;
 /* current processing free-run type, used by file-I/O */
 static char gdb_running_type;
 
+/* PacketSize advertised to new gdb connections */
+static unsigned int gdb_packet_size = GDB_BUFFER_SIZE;
+#define GDB_PACKET_SIZE_MIN	1024
+#define GDB_PACKET_SIZE_MAX	(1024 * 1024)
+
 static int gdb_last_signal(struct target *target)
 {
 	switch (target->debug_reason) {
@@ -167,6 +214,30 @@ static int gdb_last_signal(struct target *target)
 	}
 }
 
+/**
+ * Return a buffer of at least @a size bytes for use while handling the
+ * current packet. It belongs to the connection and is reused for each
+ * packet, so once it has grown to fit the usual packets nothing needs to
+ * be allocated for them anymore. Only one user at a time: the contents are
+ * gone with the next call.
+ */
+static void *gdb_scratch(struct connection *connection, size_t size)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+
+	if (size > gdb_con->scratch_size) {
+		void *p = realloc(gdb_con->scratch, size);
+		if (!p) {
+			LOG_ERROR("Out of memory");
+			return NULL;
+		}
+		gdb_con->scratch = p;
+		gdb_con->scratch_size = size;
+	}
+
+	return gdb_con->scratch;
+}
+
 static int check_pending(struct connection *connection,
 		int timeout_s, int *got_data)
 {
@@ -174,7 +245,7 @@ static int check_pending(struct connection *connection,
 	 * but return with as many bytes as are available immediately
 	 */
 	struct timeval tv;
-	fd_set read_fds;
+	fd_set read_fds, write_fds;
 	struct gdb_connection *gdb_con = connection->priv;
 	int t;
 	if (!got_data)
@@ -186,22 +257,37 @@ static int check_pending(struct connection *connection,
 		return ERROR_OK;
 	}
 
-	FD_ZERO(&read_fds);
-	FD_SET(connection->fd, &read_fds);
-
 	tv.tv_sec = timeout_s;
 	tv.tv_usec = 0;
-	if (socket_select(connection->fd + 1, &read_fds, NULL, NULL, &tv) == 0) {
-		/* This can typically be because a "monitor" command took too long
-		 * before printing any progress messages
-		 */
-		if (timeout_s > 0)
-			return ERROR_GDB_TIMEOUT;
-		else
+	for (;;) {
+		/* gdb won't answer before it has seen all of our output */
+		if (connection_flush(connection) != ERROR_OK) {
+			gdb_con->closed = true;
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+		bool flushing = connection_output_pending(connection);
+
+		FD_ZERO(&read_fds);
+		FD_SET(connection->fd, &read_fds);
+		FD_ZERO(&write_fds);
+		if (flushing)
+			FD_SET(connection->fd, &write_fds);
+
+		int retval = socket_select(connection->fd + 1, &read_fds, &write_fds, NULL, &tv);
+		if (retval == 0) {
+			/* This can typically be because a "monitor" command took too long
+			 * before printing any progress messages
+			 */
+			if (timeout_s > 0)
+				return ERROR_GDB_TIMEOUT;
+			else
+				return ERROR_OK;
+		}
+		/* on errors, let the read report what went wrong */
+		*got_data = retval < 0 || FD_ISSET(connection->fd, &read_fds);
+		if (*got_data || !flushing)
 			return ERROR_OK;
 	}
-	*got_data = FD_ISSET(connection->fd, &read_fds) != 0;
-	return ERROR_OK;
 }
 
 static int gdb_get_char_inner(struct connection *connection, int *next_char)
@@ -754,6 +840,44 @@ static int gdb_output_con(struct connection *connection, const char *line)
 	return retval;
 }
 
+/**
+ * Send an asynchronous notification, e.g. "Stop:T05", as used in non-stop
+ * mode. Unlike packets, notifications are not acknowledged by gdb.
+ */
+static int gdb_put_notification(struct connection *connection, char *buffer, int len)
+{
+	unsigned char checksum = 0;
+	char trailer[4];
+
+	for (int i = 0; i < len; i++)
+		checksum += buffer[i];
+	snprintf(trailer, sizeof(trailer), "#%02x", checksum);
+
+	gdb_log_outgoing_packet(buffer, len, checksum);
+
+	int retval = gdb_write(connection, "%", 1);
+	if (retval == ERROR_OK)
+		retval = gdb_write(connection, buffer, len);
+	if (retval == ERROR_OK)
+		retval = gdb_write(connection, trailer, 3);
+	return retval;
+}
+
+/* Report a stop to gdb: as reply to the pending resume packet in all-stop
+ * mode, or as a notification in non-stop mode */
+static void gdb_put_stop_reply(struct connection *connection, const char *reply, int len)
+{
+	struct gdb_connection *gdb_connection = connection->priv;
+
+	if (gdb_connection->non_stop) {
+		char notification[80];
+		int n = snprintf(notification, sizeof(notification), "Stop:%.*s", len, reply);
+		gdb_put_notification(connection, notification, n);
+	} else {
+		gdb_put_packet(connection, (char *)reply, len);
+	}
+}
+
 static int gdb_output(struct command_context *context, const char *line)
 {
 	/* this will be dumped to the log and also sent as an O packet if possible */
@@ -783,7 +907,9 @@ static void gdb_signal_reply(struct target *target, struct connection *connectio
 			ct = target;
 		}
 
-		if (gdb_connection->ctrl_c) {
+		if (gdb_connection->stop_requested) {
+			signal_var = 0x0;
+		} else if (gdb_connection->ctrl_c) {
 			signal_var = 0x2;
 		} else
 			signal_var = gdb_last_signal(ct);
@@ -823,9 +949,10 @@ static void gdb_signal_reply(struct target *target, struct connection *connectio
 				signal_var, stop_reason, current_thread);
 
 		gdb_connection->ctrl_c = false;
+		gdb_connection->stop_requested = false;
 	}
 
-	gdb_put_packet(connection, sig_reply, sig_reply_len);
+	gdb_put_stop_reply(connection, sig_reply, sig_reply_len);
 	gdb_connection->frontend_state = TARGET_HALTED;
 }
 
@@ -965,6 +1092,75 @@ static int gdb_target_callback_event_handler(struct target *target,
 	return ERROR_OK;
 }
 
+/*
+ * Several GDB connections to one target.
+ *
+ * Only one connection controls the target: it resumes and steps it, sets
+ * breakpoints, writes memory and registers and runs monitor commands. The
+ * first connection does so; connections made while it is open are read-only
+ * observers, which e.g. watch variables of a running target. An observer
+ * takes over control when it asks for it after the controlling connection
+ * went away.
+ */
+
+/* Whether another connection of the service controls the target */
+static bool gdb_has_controller(struct service *service)
+{
+	for (struct connection *c = service->connections; c; c = c->next) {
+		struct gdb_connection *gdb_con = c->priv;
+
+		if (gdb_con && !gdb_con->observer)
+			return true;
+	}
+	return false;
+}
+
+/* Whether the connection may control the target; an observer takes over
+ * control if nobody else holds it. */
+static bool gdb_claim_control(struct connection *connection)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+
+	if (!gdb_con->observer)
+		return true;
+	if (gdb_has_controller(connection->service))
+		return false;
+
+	LOG_INFO("GDB connection on target %s takes over control of the target",
+			target_name(get_target_from_connection(connection)));
+	gdb_con->observer = false;
+	return true;
+}
+
+/* Packets only the connection controlling the target may send */
+static bool gdb_packet_controls_target(const char *packet)
+{
+	switch (packet[0]) {
+		case 'c':
+		case 's':
+		case 'G':
+		case 'P':
+		case 'M':
+		case 'X':
+		case 'z':
+		case 'Z':
+		case 'R':
+		case 'F':
+		case 'J':
+			return true;
+		case 'q':
+			return strncmp(packet, "qRcmd,", 6) == 0;
+		case 'v':
+			return strncmp(packet, "vCont;", 6) == 0
+				|| strncmp(packet, "vFlash", 6) == 0
+				|| strncmp(packet, "vRun", 4) == 0
+				|| strncmp(packet, "vAttach", 7) == 0
+				|| strncmp(packet, "vKill", 5) == 0;
+		default:
+			return false;
+	}
+}
+
 static int gdb_new_connection(struct connection *connection)
 {
 	struct gdb_connection *gdb_connection = malloc(sizeof(struct gdb_connection));
@@ -972,6 +1168,11 @@ static int gdb_new_connection(struct connection *connection)
 	int retval;
 	int initial_ack;
 
+	if (!gdb_connection) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
 	target = get_target_from_connection(connection);
 	connection->priv = gdb_connection;
 	connection->cmd_ctx->current_target = target;
@@ -989,9 +1190,23 @@ static int gdb_new_connection(struct connection *connection)
 	gdb_connection->mem_write_error = false;
 	gdb_connection->attached = true;
 	gdb_connection->extended_protocol = false;
+	gdb_connection->non_stop = false;
+	gdb_connection->stop_requested = false;
 	gdb_connection->target_desc.tdesc = NULL;
 	gdb_connection->target_desc.tdesc_length = 0;
 	gdb_connection->thread_list = NULL;
+	gdb_connection->scratch = NULL;
+	gdb_connection->scratch_size = 0;
+	memset(&gdb_connection->crc_cache, 0, sizeof(gdb_connection->crc_cache));
+	gdb_connection->observer = gdb_has_controller(connection->service);
+	gdb_connection->packet_size = gdb_packet_size;
+	gdb_connection->packet_buffer = malloc(gdb_packet_size + 1); /* Extra byte for null-termination */
+	if (!gdb_connection->packet_buffer) {
+		LOG_ERROR("Out of memory");
+		free(gdb_connection);
+		connection->priv = NULL;
+		return ERROR_FAIL;
+	}
 
 	/* send ACK to GDB for debug request */
 	gdb_write(connection, "+", 1);
@@ -1001,10 +1216,13 @@ static int gdb_new_connection(struct connection *connection)
 
 	/* we must remove all breakpoints registered to the target as a previous
 	 * GDB session could leave dangling breakpoints if e.g. communication
-	 * timed out.
+	 * timed out. Not so for an observer, the breakpoints belong to the
+	 * connection controlling the target.
 	 */
-	breakpoint_clear_target(target);
-	watchpoint_clear_target(target);
+	if (!gdb_connection->observer) {
+		breakpoint_clear_target(target);
+		watchpoint_clear_target(target);
+	}
 
 	/* Since version 3.95 (gdb-19990504), with the exclusion of 6.5~6.8, GDB
 	 * sends an ACK at connection with the following comment in its source code:
@@ -1019,7 +1237,9 @@ static int gdb_new_connection(struct connection *connection)
 	if (initial_ack != '+')
 		gdb_putback_char(connection, initial_ack);
 
-	target_call_event_callbacks(target, TARGET_EVENT_GDB_ATTACH);
+	/* an observer must not halt the target under the controlling connection */
+	if (!gdb_connection->observer)
+		target_call_event_callbacks(target, TARGET_EVENT_GDB_ATTACH);
 
 	if (target->rtos) {
 		/* clean previous rtos session if supported*/
@@ -1065,7 +1285,10 @@ static int gdb_new_connection(struct connection *connection)
 		return ERROR_TARGET_NOT_EXAMINED;
 	}
 
-	if (target->state != TARGET_HALTED)
+	if (gdb_connection->observer)
+		LOG_INFO("GDB connection %d on target %s is read-only, another connection controls the target",
+				gdb_actual_connections, target_name(target));
+	else if (target->state != TARGET_HALTED)
 		LOG_WARNING("GDB connection %d on target %s not halted",
 					gdb_actual_connections, target_name(target));
 
@@ -1107,11 +1330,21 @@ static int gdb_connection_closed(struct connection *connection)
 	/* if this connection registered a debug-message receiver delete it */
 	delete_debug_msg_receiver(connection->cmd_ctx, target);
 
+	read_scheduler_cancel(connection);
+
+	free(gdb_connection->packet_buffer);
+	free(gdb_connection->scratch);
+	free(gdb_connection->crc_cache.region);
+	bool observer = gdb_connection->observer;
 	free(connection->priv);
 	connection->priv = NULL;
 
 	target_unregister_event_callback(gdb_target_callback_event_handler, connection);
 
+	/* the target stays with the connection controlling it */
+	if (observer)
+		return ERROR_OK;
+
 	target_call_event_callbacks(target, TARGET_EVENT_GDB_END);
 
 	target_call_event_callbacks(target, TARGET_EVENT_GDB_DETACH);
@@ -1141,6 +1374,17 @@ static int gdb_last_signal_packet(struct connection *connection,
 		return ERROR_OK;
 	}
 
+	if (gdb_con->non_stop) {
+		/* report the stopped thread, gdb then asks for more with vStopped */
+		if (target->state != TARGET_HALTED) {
+			gdb_put_packet(connection, "OK", 2);
+			return ERROR_OK;
+		}
+		snprintf(sig_reply, 4, "T%2.2x", gdb_last_signal(target));
+		gdb_put_packet(connection, sig_reply, 3);
+		return ERROR_OK;
+	}
+
 	signal_var = gdb_last_signal(target);
 
 	snprintf(sig_reply, 4, "S%2.2x", signal_var);
@@ -1236,9 +1480,11 @@ static int gdb_get_registers_packet(struct connection *connection,
 
 	assert(reg_packet_size > 0);
 
-	reg_packet = malloc(reg_packet_size + 1); /* plus one for string termination null */
-	if (!reg_packet)
+	reg_packet = gdb_scratch(connection, reg_packet_size + 1); /* plus one for string termination null */
+	if (!reg_packet) {
+		free(reg_list);
 		return ERROR_FAIL;
+	}
 
 	reg_packet_p = reg_packet;
 
@@ -1249,7 +1495,6 @@ static int gdb_get_registers_packet(struct connection *connection,
 			retval = reg_list[i]->type->get(reg_list[i]);
 			if (retval != ERROR_OK && gdb_report_register_access_error) {
 				LOG_DEBUG("Couldn't get register %s.", reg_list[i]->name);
-				free(reg_packet);
 				free(reg_list);
 				return gdb_error(connection, retval);
 			}
@@ -1268,7 +1513,6 @@ static int gdb_get_registers_packet(struct connection *connection,
 #endif
 
 	gdb_put_packet(connection, reg_packet, reg_packet_size);
-	free(reg_packet);
 
 	free(reg_list);
 
@@ -1311,21 +1555,22 @@ static int gdb_set_registers_packet(struct connection *connection,
 		if (packet_p + chars > packet + packet_size)
 			LOG_ERROR("BUG: register packet is too small for registers");
 
-		bin_buf = malloc(DIV_ROUND_UP(reg_list[i]->size, 8));
+		bin_buf = gdb_scratch(connection, DIV_ROUND_UP(reg_list[i]->size, 8));
+		if (!bin_buf) {
+			free(reg_list);
+			return ERROR_FAIL;
+		}
 		gdb_target_to_reg(target, packet_p, chars, bin_buf);
 
 		retval = reg_list[i]->type->set(reg_list[i], bin_buf);
 		if (retval != ERROR_OK && gdb_report_register_access_error) {
 			LOG_DEBUG("Couldn't set register %s.", reg_list[i]->name);
 			free(reg_list);
-			free(bin_buf);
 			return gdb_error(connection, retval);
 		}
 
 		/* advance packet pointer */
 		packet_p += chars;
-
-		free(bin_buf);
 	}
 
 	/* free struct reg *reg_list[] array allocated by get_gdb_reg_list */
@@ -1464,19 +1709,101 @@ static int gdb_error(struct connection *connection, int retval)
 	return ERROR_OK;
 }
 
+/* Escape binary data as in 'X' packets, returns the escaped length.
+ * @a out may overlap @a data as long as it starts at least @a len bytes
+ * earlier, as output never gets ahead of the input by more than that. */
+static size_t gdb_escape_binary(char *out, const uint8_t *data, size_t len)
+{
+	size_t pos = 0;
+
+	for (size_t i = 0; i < len; i++) {
+		uint8_t c = data[i];
+
+		if (c == '#' || c == '$' || c == '}' || c == '*') {
+			out[pos++] = '}';
+			out[pos++] = c ^ 0x20;
+		} else {
+			out[pos++] = c;
+		}
+	}
+
+	return pos;
+}
+
+/* Reply to an 'm' or 'x' packet with the memory that was read into the upper
+ * half of the scratch buffer. The reply is built in place, converting front
+ * to back, which never overwrites bytes that haven't been converted yet. */
+static int gdb_read_memory_reply(struct connection *connection, int retval,
+		uint32_t len, bool binary)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	char *reply = gdb_con->scratch;
+	uint8_t *buffer = (uint8_t *)reply + len + (binary ? 1 : 0);
+
+	if ((retval != ERROR_OK) && !gdb_report_data_abort) {
+		/* TODO : Here we have to lie and send back all zero's lest stack traces won't work.
+		 * At some point this might be fixed in GDB, in which case this code can be removed.
+		 *
+		 * OpenOCD developers are acutely aware of this problem, but there is nothing
+		 * gained by involving the user in this problem that hopefully will get resolved
+		 * eventually
+		 *
+		 * http://sourceware.org/cgi-bin/gnatsweb.pl? \
+		 * cmd = view%20audit-trail&database = gdb&pr = 2395
+		 *
+		 * For now, the default is to fix up things to make current GDB versions work.
+		 * This can be overwritten using the gdb_report_data_abort <'enable'|'disable'> command.
+		 */
+		memset(buffer, 0, len);
+		retval = ERROR_OK;
+	}
+
+	if (retval == ERROR_OK) {
+		size_t pkt_len;
+
+		if (binary) {
+			reply[0] = 'b';
+			pkt_len = 1 + gdb_escape_binary(reply + 1, buffer, len);
+		} else {
+			pkt_len = hexify(reply, buffer, len, 2 * len + 1);
+		}
+
+		gdb_put_packet(connection, reply, pkt_len);
+	} else
+		retval = gdb_error(connection, retval);
+
+	return retval;
+}
+
+/* Completion of a read handed to the read scheduler */
+static void gdb_read_memory_done(struct connection *connection, int retval,
+		const uint8_t *data, uint32_t size)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+	bool binary = gdb_con->read_binary;
+
+	/* the scratch buffer was sized when the read was submitted */
+	if (retval == ERROR_OK)
+		memcpy((uint8_t *)gdb_con->scratch + size + (binary ? 1 : 0), data, size);
+	gdb_read_memory_reply(connection, retval, size, binary);
+}
+
 /* We don't have to worry about the default 2 second timeout for GDB packets,
  * because GDB breaks up large memory reads into smaller reads.
  */
+/* handles both 'm' (hex) and 'x' (binary) memory read packets */
 static int gdb_read_memory_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
 	struct target *target = get_target_from_connection(connection);
+	struct gdb_connection *gdb_con = connection->priv;
 	char *separator;
 	uint64_t addr = 0;
 	uint32_t len = 0;
+	bool binary = packet[0] == 'x';
 
 	uint8_t *buffer;
-	char *hex_buffer;
+	char *reply;
 
 	int retval = ERROR_OK;
 
@@ -1493,53 +1820,39 @@ static int gdb_read_memory_packet(struct connection *connection,
 	len = strtoul(separator + 1, NULL, 16);
 
 	if (!len) {
+		if (binary) {
+			gdb_put_packet(connection, "b", 1);
+			return ERROR_OK;
+		}
 		LOG_WARNING("invalid read memory packet received (len == 0)");
 		gdb_put_packet(connection, "", 0);
 		return ERROR_OK;
 	}
 
-	buffer = malloc(len);
+	/* memory is read into the upper half of the reply buffer,
+	 * see gdb_read_memory_reply() */
+	reply = gdb_scratch(connection, 2 * len + 1);
+	if (!reply)
+		return gdb_error(connection, ERROR_FAIL);
+	buffer = (uint8_t *)reply + len + (binary ? 1 : 0);
 
 	LOG_DEBUG("addr: 0x%16.16" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
+	/* batched with the reads of other connections if possible,
+	 * the reply is then sent by gdb_read_memory_done() */
+	if (!target->rtos && read_scheduler_submit(connection, target, addr, len,
+			gdb_read_memory_done) == ERROR_OK) {
+		gdb_con->read_binary = binary;
+		return ERROR_OK;
+	}
+
 	retval = ERROR_NOT_IMPLEMENTED;
 	if (target->rtos)
 		retval = rtos_read_buffer(target, addr, len, buffer);
 	if (retval == ERROR_NOT_IMPLEMENTED)
-		retval = target_read_buffer(target, addr, len, buffer);
-
-	if ((retval != ERROR_OK) && !gdb_report_data_abort) {
-		/* TODO : Here we have to lie and send back all zero's lest stack traces won't work.
-		 * At some point this might be fixed in GDB, in which case this code can be removed.
-		 *
-		 * OpenOCD developers are acutely aware of this problem, but there is nothing
-		 * gained by involving the user in this problem that hopefully will get resolved
-		 * eventually
-		 *
-		 * http://sourceware.org/cgi-bin/gnatsweb.pl? \
-		 * cmd = view%20audit-trail&database = gdb&pr = 2395
-		 *
-		 * For now, the default is to fix up things to make current GDB versions work.
-		 * This can be overwritten using the gdb_report_data_abort <'enable'|'disable'> command.
-		 */
-		memset(buffer, 0, len);
-		retval = ERROR_OK;
-	}
-
-	if (retval == ERROR_OK) {
-		hex_buffer = malloc(len * 2 + 1);
-
-		size_t pkt_len = hexify(hex_buffer, buffer, len, len * 2 + 1);
-
-		gdb_put_packet(connection, hex_buffer, pkt_len);
-
-		free(hex_buffer);
-	} else
-		retval = gdb_error(connection, retval);
+		retval = target_read_memory_cached(target, addr, len, buffer);
 
-	free(buffer);
-
-	return retval;
+	return gdb_read_memory_reply(connection, retval, len, binary);
 }
 
 static int gdb_write_memory_packet(struct connection *connection,
@@ -1570,7 +1883,9 @@ static int gdb_write_memory_packet(struct connection *connection,
 		return ERROR_SERVER_REMOTE_CLOSED;
 	}
 
-	buffer = malloc(len);
+	buffer = gdb_scratch(connection, len);
+	if (!buffer)
+		return gdb_error(connection, ERROR_FAIL);
 
 	LOG_DEBUG("addr: 0x%" PRIx64 ", len: 0x%8.8" PRIx32 "", addr, len);
 
@@ -1588,8 +1903,6 @@ static int gdb_write_memory_packet(struct connection *connection,
 	else
 		retval = gdb_error(connection, retval);
 
-	free(buffer);
-
 	return retval;
 }
 
@@ -2713,6 +3026,84 @@ static int gdb_get_thread_list_chunk(struct target *target, char **thread_list,
 	return ERROR_OK;
 }
 
+/**
+ * Calculate the CRC for a qCRC packet. GDB's compare-sections sends one
+ * of those per section, which would mean as many algorithm runs. Instead,
+ * the first request that covers at least half of a small enough flash bank
+ * while the target is halted reads the whole bank once, and this and all
+ * further requests for it are answered on the host. Anything else is
+ * calculated on the target, and the results are remembered for repeated
+ * requests.
+ * All of this only holds until the target memory changes.
+ */
+static int gdb_crc_memory(struct connection *connection, target_addr_t addr,
+		uint32_t len, uint32_t *checksum)
+{
+	struct target *target = get_target_from_connection(connection);
+	struct gdb_connection *gdb_con = connection->priv;
+	struct gdb_crc_cache *cache = &gdb_con->crc_cache;
+	int retval;
+
+	if (target->state != TARGET_HALTED || addr + len < addr)
+		return target_checksum_memory(target, addr, len, checksum);
+
+	if (cache->target != target || cache->epoch != target->memory_epoch) {
+		free(cache->region);
+		memset(cache, 0, sizeof(*cache));
+		cache->target = target;
+	}
+
+	for (unsigned int i = 0; i < cache->num_results; i++) {
+		if (cache->results[i].address == addr && cache->results[i].size == len) {
+			*checksum = cache->results[i].crc;
+			return ERROR_OK;
+		}
+	}
+
+	if (!cache->region_tried) {
+		struct flash_bank *bank;
+
+		/* reading the whole bank only pays off for requests covering most
+		 * of it, smaller ones are cheaper to checksum on the target */
+		if (get_flash_bank_by_addr(target, addr, false, &bank) == ERROR_OK && bank
+				&& bank->size <= GDB_CRC_REGION_MAX
+				&& len >= bank->size / 2
+				&& addr + len <= bank->base + bank->size) {
+			cache->region_tried = true;
+			cache->region = malloc(bank->size);
+			if (cache->region && target_read_buffer(target, bank->base,
+					bank->size, cache->region) == ERROR_OK) {
+				cache->region_address = bank->base;
+				cache->region_size = bank->size;
+			} else {
+				free(cache->region);
+				cache->region = NULL;
+			}
+		}
+	}
+
+	if (cache->region && addr >= cache->region_address
+			&& addr + len <= cache->region_address + cache->region_size) {
+		retval = image_calculate_checksum(cache->region + (addr - cache->region_address),
+				len, checksum);
+	} else {
+		retval = target_checksum_memory(target, addr, len, checksum);
+		if (retval == ERROR_OK) {
+			cache->results[cache->next_result].address = addr;
+			cache->results[cache->next_result].size = len;
+			cache->results[cache->next_result].crc = *checksum;
+			cache->next_result = (cache->next_result + 1) % GDB_CRC_RESULTS;
+			if (cache->num_results < GDB_CRC_RESULTS)
+				cache->num_results++;
+		}
+	}
+
+	/* probing banks or running the checksum algorithm in the working area
+	 * doesn't change the memory we are looking at */
+	cache->epoch = target->memory_epoch;
+	return retval;
+}
+
 static int gdb_query_packet(struct connection *connection,
 		char const *packet, int packet_size)
 {
@@ -2762,7 +3153,7 @@ static int gdb_query_packet(struct connection *connection,
 
 			len = strtoul(separator + 1, NULL, 16);
 
-			retval = target_checksum_memory(target, addr, len, &checksum);
+			retval = gdb_crc_memory(connection, addr, len, &checksum);
 
 			if (retval == ERROR_OK) {
 				snprintf(gdb_reply, 10, "C%8.8" PRIx32 "", checksum);
@@ -2802,8 +3193,8 @@ static int gdb_query_packet(struct connection *connection,
 			&buffer,
 			&pos,
 			&size,
-			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;vContSupported+",
-			GDB_BUFFER_SIZE,
+			"PacketSize=%x;qXfer:memory-map:read%c;qXfer:features:read%c;qXfer:threads:read+;QStartNoAckMode+;vContSupported+;binary-upload+;QNonStop+",
+			gdb_connection->packet_size,
 			((gdb_use_memory_map == 1) && (flash_get_bank_count() > 0)) ? '+' : '-',
 			(gdb_target_desc_supported == 1) ? '+' : '-');
 
@@ -2881,6 +3272,11 @@ static int gdb_query_packet(struct connection *connection,
 
 		free(xml);
 		return ERROR_OK;
+	} else if (strncmp(packet, "QNonStop:", 9) == 0) {
+		gdb_connection->non_stop = packet[9] == '1';
+		LOG_DEBUG("gdb %s non-stop mode", gdb_connection->non_stop ? "enabled" : "disabled");
+		gdb_put_packet(connection, "OK", 2);
+		return ERROR_OK;
 	} else if (strncmp(packet, "QStartNoAckMode", 15) == 0) {
 		gdb_connection->noack_mode = 1;
 		gdb_put_packet(connection, "OK", 2);
@@ -2902,7 +3298,7 @@ static bool gdb_handle_vcont_packet(struct connection *connection, const char *p
 	if (parse[0] == '?') {
 		if (target->type->step) {
 			/* gdb doesn't accept c without C and s without S */
-			gdb_put_packet(connection, "vCont;c;C;s;S", 13);
+			gdb_put_packet(connection, "vCont;c;C;s;S;t", 15);
 			return true;
 		}
 		return false;
@@ -2913,11 +3309,39 @@ static bool gdb_handle_vcont_packet(struct connection *connection, const char *p
 		--packet_size;
 	}
 
+	/* stop, only meaningful in non-stop mode */
+	if (parse[0] == 't') {
+		if (!gdb_connection->non_stop)
+			return false;
+
+		gdb_put_packet(connection, "OK", 2);
+		if (target->state == TARGET_RUNNING) {
+			/* the stop is reported by a notification once halted */
+			gdb_connection->stop_requested = true;
+			retval = target_halt(target);
+			if (retval == ERROR_OK)
+				retval = target_poll(target);
+			if (retval != ERROR_OK)
+				target_call_event_callbacks(target, TARGET_EVENT_GDB_HALT);
+		} else if (gdb_connection->frontend_state == TARGET_RUNNING) {
+			gdb_connection->stop_requested = true;
+			gdb_frontend_halted(target, connection);
+		}
+		return true;
+	}
+
+	/* in non-stop mode resuming is acknowledged right away, the stop
+	 * follows as a notification */
+	if (gdb_connection->non_stop && (parse[0] == 'c' || parse[0] == 's'))
+		gdb_put_packet(connection, "OK", 2);
+
 	/* simple case, a continue packet */
 	if (parse[0] == 'c') {
 		gdb_running_type = 'c';
 		LOG_DEBUG("target %s continue", target_name(target));
-		log_add_callback(gdb_log_callback, connection);
+		/* console output can't be sent while running in non-stop mode */
+		if (!gdb_connection->non_stop)
+			log_add_callback(gdb_log_callback, connection);
 		retval = target_resume(target, 1, 0, 0, 0);
 		if (retval == ERROR_TARGET_NOT_HALTED)
 			LOG_INFO("target %s was not halted when resume was requested", target_name(target));
@@ -3170,6 +3594,13 @@ static int gdb_v_packet(struct connection *connection,
 
 	struct target *target = get_target_from_connection(connection);
 
+	if (strncmp(packet, "vStopped", 8) == 0) {
+		/* all stops have been reported with the first notification, as
+		 * there is only a single thread to stop */
+		gdb_put_packet(connection, "OK", 2);
+		return ERROR_OK;
+	}
+
 	if (strncmp(packet, "vCont", 5) == 0) {
 		bool handled;
 
@@ -3399,19 +3830,69 @@ static void gdb_sig_halted(struct connection *connection)
 {
 	char sig_reply[4];
 	snprintf(sig_reply, 4, "T%2.2x", 2);
-	gdb_put_packet(connection, sig_reply, 3);
+	gdb_put_stop_reply(connection, sig_reply, 3);
 }
 
-static int gdb_input_inner(struct connection *connection)
+/* Packets handled from server_yield(): they only read the target, or step
+ * or resume it, none of which can upset the command that yields */
+static bool gdb_packet_yields(const char *packet, int len)
 {
-	/* Do not allocate this on the stack */
-	static char gdb_packet_buffer[GDB_BUFFER_SIZE + 1]; /* Extra byte for null-termination */
+	switch (packet[0]) {
+		case '?':
+		case 'g':
+		case 'p':
+		case 'm':
+		case 'x':
+		case 'H':
+		case 'T':
+		case 'c':
+		case 's':
+		case 'z':
+		case 'Z':
+			return true;
+		case 'q':
+			return len < 6 || strncmp(packet, "qRcmd,", 6) != 0;
+		case 'v':
+			return len >= 5 && strncmp(packet, "vCont", 5) == 0;
+		default:
+			return false;
+	}
+}
+
+/* Whether the buffered input starts with an interrupt or a complete packet
+ * that may be handled from server_yield(). Everything else, and whatever
+ * follows it, waits for server_loop(). */
+static bool gdb_yield_packet_ready(struct gdb_connection *gdb_con)
+{
+	const char *p = gdb_con->buf_p;
+	const char *end = p + gdb_con->buf_cnt;
+
+	/* acknowledgments are consumed along with the packet */
+	while (p < end && (*p == '+' || *p == '-'))
+		p++;
+	if (p == end)
+		return false;
+	if (*p == 0x3)
+		return true;
+	if (*p != '$')
+		return false;
 
+	/* '#' only ever shows up escaped inside a packet */
+	const char *hash = memchr(p, '#', end - p);
+	if (!hash || end - hash < 3 || hash == p + 1)
+		return false;
+
+	return gdb_packet_yields(p + 1, hash - p - 1);
+}
+
+static int gdb_input_inner(struct connection *connection)
+{
 	struct target *target;
-	char const *packet = gdb_packet_buffer;
 	int packet_size;
 	int retval;
 	struct gdb_connection *gdb_con = connection->priv;
+	char *gdb_packet_buffer = gdb_con->packet_buffer;
+	char const *packet = gdb_packet_buffer;
 	static bool warn_use_ext;
 
 	target = get_target_from_connection(connection);
@@ -3428,7 +3909,10 @@ static int gdb_input_inner(struct connection *connection)
 	 * drain the rest of the buffer.
 	 */
 	do {
-		packet_size = GDB_BUFFER_SIZE;
+		if (gdb_con->yielding && !gdb_yield_packet_ready(gdb_con))
+			return ERROR_OK;
+
+		packet_size = gdb_con->packet_size;
 		retval = gdb_get_packet(connection, gdb_packet_buffer, &packet_size);
 		if (retval != ERROR_OK)
 			return retval;
@@ -3438,6 +3922,13 @@ static int gdb_input_inner(struct connection *connection)
 
 		gdb_log_incoming_packet(gdb_packet_buffer);
 
+		if (packet_size > 0 && gdb_packet_controls_target(packet)
+				&& !gdb_claim_control(connection)) {
+			LOG_DEBUG("read-only GDB connection, refusing 0x%2.2x packet", packet[0]);
+			gdb_send_error(connection, EPERM);
+			packet_size = 0;
+		}
+
 		if (packet_size > 0) {
 			retval = ERROR_OK;
 			switch (packet[0]) {
@@ -3467,6 +3958,7 @@ static int gdb_input_inner(struct connection *connection)
 					retval = gdb_set_register_packet(connection, packet, packet_size);
 					break;
 				case 'm':
+				case 'x':
 					retval = gdb_read_memory_packet(connection, packet, packet_size);
 					break;
 				case 'M':
@@ -3618,6 +4110,17 @@ static int gdb_input_inner(struct connection *connection)
 			/* if a packet handler returned an error, exit input loop */
 			if (retval != ERROR_OK)
 				return retval;
+
+			/* the reply comes from read_scheduler_run(), which runs once all
+			 * connections have had their turn; the next packet waits for it */
+			if (read_scheduler_pending(connection))
+				return ERROR_OK;
+		}
+
+		if (gdb_con->ctrl_c && gdb_con->observer) {
+			/* an observer never resumed the target, so it has nothing to interrupt */
+			LOG_DEBUG("read-only GDB connection, ignoring interrupt");
+			gdb_con->ctrl_c = false;
 		}
 
 		if (gdb_con->ctrl_c) {
@@ -3644,7 +4147,9 @@ static int gdb_input_inner(struct connection *connection)
 
 static int gdb_input(struct connection *connection)
 {
+	enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_GDB);
 	int retval = gdb_input_inner(connection);
+	adapter_stats_leave(op);
 	struct gdb_connection *gdb_con = connection->priv;
 	if (retval == ERROR_SERVER_REMOTE_CLOSED)
 		return retval;
@@ -3657,6 +4162,39 @@ static int gdb_input(struct connection *connection)
 	return ERROR_OK;
 }
 
+/* Input handler of server_yield(), for packets that arrive while a long
+ * command of another connection runs */
+static int gdb_yield_input(struct connection *connection)
+{
+	struct gdb_connection *gdb_con = connection->priv;
+
+	if (gdb_con->busy || gdb_con->closed || read_scheduler_pending(connection))
+		return ERROR_OK;
+
+	/* only what is there already, never wait for more */
+	if (gdb_con->buf_cnt <= 0) {
+		int count = read_socket(connection->fd, gdb_con->buffer, GDB_BUFFER_SIZE);
+		if (count <= 0) {
+			/* the connection was closed, or there was nothing after all;
+			 * server_loop() finds out which */
+			connection->input_pending = count == 0;
+			return ERROR_OK;
+		}
+		gdb_con->buf_p = gdb_con->buffer;
+		gdb_con->buf_cnt = count;
+	}
+
+	enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_GDB);
+	gdb_con->yielding = true;
+	int retval = gdb_input_inner(connection);
+	gdb_con->yielding = false;
+	adapter_stats_leave(op);
+
+	/* leftovers and errors are server_loop()'s business */
+	connection->input_pending = gdb_con->buf_cnt > 0 || retval != ERROR_OK;
+	return retval;
+}
+
 static int gdb_target_start(struct target *target, const char *port)
 {
 	struct gdb_service *gdb_service;
@@ -3676,6 +4214,8 @@ static int gdb_target_start(struct target *target, const char *port)
 	ret = add_service("gdb",
 			port, target->gdb_max_connections, &gdb_new_connection, &gdb_input,
 			&gdb_connection_closed, gdb_service);
+	if (ret == ERROR_OK)
+		service_set_yield_handler("gdb", port, &gdb_yield_input);
 	/* initialize all targets gdb service with the same pointer */
 	{
 		struct target_list *head;
@@ -3814,6 +4354,26 @@ COMMAND_HANDLER(handle_gdb_report_data_abort_command)
 	return ERROR_OK;
 }
 
+COMMAND_HANDLER(handle_gdb_packet_size_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int size;
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], size);
+		if (size < GDB_PACKET_SIZE_MIN || size > GDB_PACKET_SIZE_MAX) {
+			command_print(CMD, "packet size must be between %u and %u bytes",
+				GDB_PACKET_SIZE_MIN, GDB_PACKET_SIZE_MAX);
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		}
+		gdb_packet_size = size;
+	}
+
+	command_print(CMD, "%u", gdb_packet_size);
+	return ERROR_OK;
+}
+
 COMMAND_HANDLER(handle_gdb_report_register_access_error)
 {
 	if (CMD_ARGC != 1)
@@ -3944,6 +4504,13 @@ static const struct command_registration gdb_command_handlers[] = {
 		.help = "enable or disable reporting data aborts",
 		.usage = "('enable'|'disable')"
 	},
+	{
+		.name = "gdb_packet_size",
+		.handler = handle_gdb_packet_size_command,
+		.mode = COMMAND_ANY,
+		.help = "set or show the packet size offered to gdb connections",
+		.usage = "[size]"
+	},
 	{
 		.name = "gdb_report_register_access_error",
 		.handler = handle_gdb_report_register_access_error,
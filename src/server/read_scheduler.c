@@ -0,0 +1,219 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/align.h>
+#include <jtag/adapter_stats.h>
+#include <target/target.h>
+#include <target/armv7m.h>
+#include <target/arm_adi_v5.h>
+#include <target/memory_cache.h>
+
+#include "server.h"
+#include "read_scheduler.h"
+
+/**
+ * @file
+ *
+ * Scheduler for memory reads of several clients.
+ *
+ * Clients submit reads while server_loop() handles their input; at the end
+ * of the loop iteration read_scheduler_run() issues all of them together.
+ * On targets reached through an ADIv5 MEM-AP the reads of every client are
+ * queued as whole words and flushed with one dap_run() per DAP, so clients
+ * polling memory at the same time share adapter round trips instead of
+ * taking turns. Each client is answered from its own read, in the order it
+ * asked.
+ *
+ * Reads that can't be batched are refused, and the client reads the target
+ * itself; so are reads the memory cache serves anyway. If a batch fails,
+ * its reads are repeated one by one, so that every client gets the error of
+ * its own read.
+ */
+
+#define READ_SCHEDULER_MAX_REQUESTS	32
+#define READ_SCHEDULER_MAX_SIZE		16384
+
+struct read_request {
+	struct connection *connection;
+	struct target *target;
+	struct adiv5_ap *ap;
+	target_addr_t address;
+	uint32_t size;
+	read_scheduler_done_t done;
+	/* words covering the range, in host order until the batch completes */
+	uint32_t *words;
+	bool queued;
+	bool batched;
+};
+
+static struct read_request read_requests[READ_SCHEDULER_MAX_REQUESTS];
+static unsigned int read_num_requests;
+
+/* Number of 32-bit words covering a read */
+static uint32_t read_request_words(target_addr_t address, uint32_t size)
+{
+	target_addr_t start = address & ~(target_addr_t)3;
+	target_addr_t end = ALIGN_UP(address + size, 4);
+
+	return (end - start) / 4;
+}
+
+/**
+ * Submit a read of @a size bytes at @a address for @a connection. The
+ * @a done handler is called from read_scheduler_run() with the data.
+ *
+ * @returns ERROR_OK if the read was scheduled, ERROR_NOT_IMPLEMENTED if the
+ * caller has to read the memory itself.
+ */
+int read_scheduler_submit(struct connection *connection, struct target *target,
+		target_addr_t address, uint32_t size, read_scheduler_done_t done)
+{
+	struct armv7m_common *armv7m = target_to_armv7m_safe(target);
+	target_addr_t start = address & ~(target_addr_t)3;
+	uint32_t words = read_request_words(address, size);
+
+	if (!armv7m || !armv7m->debug_ap || !target_was_examined(target))
+		return ERROR_NOT_IMPLEMENTED;
+	if (target->state != TARGET_RUNNING && target->state != TARGET_HALTED)
+		return ERROR_NOT_IMPLEMENTED;
+	if (read_num_requests == READ_SCHEDULER_MAX_REQUESTS
+			|| size == 0 || size > READ_SCHEDULER_MAX_SIZE || address + size < address)
+		return ERROR_NOT_IMPLEMENTED;
+	/* the cache does better where it applies */
+	if (target_memory_cacheable(target, address, size))
+		return ERROR_NOT_IMPLEMENTED;
+	/* whole words are read, which must not touch anything with side effects */
+	if (target_memory_volatile(target, start, words * 4))
+		return ERROR_NOT_IMPLEMENTED;
+
+	uint32_t *buffer = malloc(words * sizeof(uint32_t));
+	if (!buffer)
+		return ERROR_NOT_IMPLEMENTED;
+
+	struct read_request *request = &read_requests[read_num_requests++];
+	request->connection = connection;
+	request->target = target;
+	request->ap = armv7m->debug_ap;
+	request->address = address;
+	request->size = size;
+	request->done = done;
+	request->words = buffer;
+	request->queued = false;
+	request->batched = false;
+	return ERROR_OK;
+}
+
+/* Queue the reads of all requests on the DAP of request first and run them */
+static void read_scheduler_run_dap(unsigned int first)
+{
+	struct adiv5_dap *dap = read_requests[first].ap->dap;
+	unsigned int num_queued = 0;
+	int retval = ERROR_OK;
+
+	for (unsigned int i = first; i < read_num_requests && retval == ERROR_OK; i++) {
+		struct read_request *request = &read_requests[i];
+
+		if (request->queued || request->ap->dap != dap)
+			continue;
+
+		request->queued = true;
+		retval = mem_ap_read_buf_u32_queued(request->ap, request->words,
+				read_request_words(request->address, request->size),
+				request->address & ~(target_addr_t)3);
+		num_queued++;
+	}
+
+	/* whatever got queued stores into the words buffers, flush it in any case */
+	if (retval == ERROR_OK)
+		retval = dap_run(dap);
+	else
+		dap_run(dap);
+
+	LOG_DEBUG("%u reads in one batch: %s", num_queued, retval == ERROR_OK ? "ok" : "failed");
+	if (retval != ERROR_OK)
+		return;
+
+	for (unsigned int i = first; i < read_num_requests; i++) {
+		struct read_request *request = &read_requests[i];
+
+		if (request->queued && request->ap->dap == dap)
+			request->batched = true;
+	}
+}
+
+/**
+ * Issue all submitted reads and hand their data to the clients. Called by
+ * server_loop() once all connections have had their turn.
+ */
+void read_scheduler_run(void)
+{
+	if (!read_num_requests)
+		return;
+
+	enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_GDB);
+
+	for (unsigned int i = 0; i < read_num_requests; i++) {
+		if (!read_requests[i].queued)
+			read_scheduler_run_dap(i);
+	}
+
+	for (unsigned int i = 0; i < read_num_requests; i++) {
+		struct read_request *request = &read_requests[i];
+		uint32_t words = read_request_words(request->address, request->size);
+		uint8_t *data = (uint8_t *)request->words;
+		int retval = ERROR_OK;
+
+		if (!request->connection) {
+			/* the client is gone */
+		} else if (request->batched) {
+			for (uint32_t w = 0; w < words; w++)
+				h_u32_to_le(data + 4 * w, request->words[w]);
+			data += request->address & 3;
+		} else {
+			retval = target_read_buffer(request->target, request->address,
+					request->size, data);
+		}
+
+		if (request->connection)
+			request->done(request->connection, retval, data, request->size);
+		free(request->words);
+	}
+
+	read_num_requests = 0;
+	adapter_stats_leave(op);
+}
+
+/* Whether a read of the connection is waiting for read_scheduler_run() */
+bool read_scheduler_pending(struct connection *connection)
+{
+	for (unsigned int i = 0; i < read_num_requests; i++) {
+		if (read_requests[i].connection == connection)
+			return true;
+	}
+	return false;
+}
+
+/* Drop the reads of a connection that is being closed */
+void read_scheduler_cancel(struct connection *connection)
+{
+	for (unsigned int i = 0; i < read_num_requests; i++) {
+		if (read_requests[i].connection == connection)
+			read_requests[i].connection = NULL;
+	}
+}
@@ -0,0 +1,34 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef OPENOCD_SERVER_READ_SCHEDULER_H
+#define OPENOCD_SERVER_READ_SCHEDULER_H
+
+#include <helper/types.h>
+
+struct connection;
+struct target;
+
+/* Called with the data of a scheduled read, or the error reading it */
+typedef void (*read_scheduler_done_t)(struct connection *connection, int retval,
+		const uint8_t *data, uint32_t size);
+
+int read_scheduler_submit(struct connection *connection, struct target *target,
+		target_addr_t address, uint32_t size, read_scheduler_done_t done);
+void read_scheduler_run(void);
+bool read_scheduler_pending(struct connection *connection);
+void read_scheduler_cancel(struct connection *connection);
+
+#endif /* OPENOCD_SERVER_READ_SCHEDULER_H */
@@ -0,0 +1,495 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/align.h>
+#include <helper/time_support.h>
+#include <target/target.h>
+#include <target/armv7m.h>
+#include <target/arm_adi_v5.h>
+
+#include "server.h"
+#include "sample_server.h"
+
+/**
+ * @file
+ *
+ * Live memory sampling server.
+ *
+ * A fixed list of memory ranges, each with its own period, is read while the
+ * target runs and streamed to every connected client as binary records. The
+ * timer runs at the greatest common divisor of the periods and every tick
+ * reads the ranges that are due. On ARMv7-M targets the reads of all those
+ * ranges are queued as whole words on the MEM-AP, with TAR auto-increment,
+ * and flushed with a single dap_run(), so a tick costs one adapter round
+ * trip no matter how many ranges it covers.
+ *
+ * Each record is, with all fields little-endian:
+ *   u32 record size in bytes, including this header
+ *   u32 sequence number, incremented for every record
+ *   u64 host timestamp in microseconds
+ *   u32 mask of the ranges in this record, bit n for the n-th range
+ *   the contents of every range in the mask, in list order
+ *
+ * Clients that do not keep up lose whole records instead of stalling the
+ * server; the sequence number shows where records were dropped.
+ */
+
+#define SAMPLE_MAX_WATCHES 32
+#define SAMPLE_MAX_BYTES 4096
+#define SAMPLE_HEADER_SIZE 20
+/* words covering all ranges, each range may straddle one extra word */
+#define SAMPLE_MAX_WORDS (SAMPLE_MAX_BYTES / 4 + SAMPLE_MAX_WATCHES)
+/* output queued for a client beyond which new records are dropped */
+#define SAMPLE_MAX_PENDING (64 * 1024)
+
+struct sample_watch {
+	target_addr_t address;
+	uint32_t size;
+	/* 0 to use sample_period_ms */
+	unsigned int period_ms;
+};
+
+struct sample_client {
+	struct connection *connection;
+	unsigned int dropped;
+	struct sample_client *next;
+};
+
+static struct sample_watch sample_watches[SAMPLE_MAX_WATCHES];
+static unsigned int sample_num_watches;
+static uint32_t sample_bytes;
+static unsigned int sample_period_ms = 10;
+static struct target *sample_target;
+static struct sample_client *sample_clients;
+static uint32_t sample_sequence;
+/* timer period and number of timer ticks so far */
+static unsigned int sample_tick_ms;
+static unsigned int sample_tick;
+/* Both buffers have their maximum size, so that they never move while
+ * MEM-AP reads into them are queued. */
+static uint8_t sample_record[SAMPLE_HEADER_SIZE + SAMPLE_MAX_BYTES];
+static uint32_t sample_words[SAMPLE_MAX_WORDS];
+
+static unsigned int sample_watch_period(const struct sample_watch *watch)
+{
+	return watch->period_ms ? watch->period_ms : sample_period_ms;
+}
+
+static unsigned int sample_gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Mask of the ranges due at the current tick */
+static uint32_t sample_due_mask(void)
+{
+	uint32_t mask = 0;
+
+	for (unsigned int i = 0; i < sample_num_watches; i++) {
+		unsigned int ticks = sample_watch_period(&sample_watches[i]) / sample_tick_ms;
+
+		if (sample_tick % ticks == 0)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+/* Number of 32-bit words covering a watched range */
+static unsigned int sample_watch_words(const struct sample_watch *watch)
+{
+	target_addr_t start = watch->address & ~(target_addr_t)3;
+	target_addr_t end = ALIGN_UP(watch->address + watch->size, 4);
+
+	return (end - start) / 4;
+}
+
+/* Queue the reads of all ranges in the mask as blocks of whole words on the MEM-AP
+ * and run them at once. The words land in sample_words in target memory order, so
+ * each range is copied out of them as is. */
+static int sample_read_mem_ap(struct adiv5_ap *ap, uint32_t mask, uint8_t *data)
+{
+	unsigned int w = 0;
+	int retval = ERROR_OK;
+
+	for (unsigned int i = 0; i < sample_num_watches && retval == ERROR_OK; i++) {
+		struct sample_watch *watch = &sample_watches[i];
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		unsigned int words = sample_watch_words(watch);
+		retval = mem_ap_read_buf_u32_queued(ap, &sample_words[w], words,
+				watch->address & ~(target_addr_t)3);
+		w += words;
+	}
+
+	/* whatever got queued stores into sample_words, flush it in any case */
+	if (retval == ERROR_OK)
+		retval = dap_run(ap->dap);
+	else
+		dap_run(ap->dap);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < w; i++)
+		h_u32_to_le((uint8_t *)&sample_words[i], sample_words[i]);
+
+	w = 0;
+	for (unsigned int i = 0; i < sample_num_watches; i++) {
+		struct sample_watch *watch = &sample_watches[i];
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		memcpy(data, (uint8_t *)&sample_words[w] + (watch->address & 3), watch->size);
+		data += watch->size;
+		w += sample_watch_words(watch);
+	}
+
+	return ERROR_OK;
+}
+
+/* Read the ranges in the mask into data, and their total length into size */
+static int sample_read(uint32_t mask, uint8_t *data, uint32_t *size)
+{
+	struct armv7m_common *armv7m = target_to_armv7m_safe(sample_target);
+
+	*size = 0;
+	for (unsigned int i = 0; i < sample_num_watches; i++)
+		if (mask & (1u << i))
+			*size += sample_watches[i].size;
+
+	if (armv7m && armv7m->debug_ap)
+		return sample_read_mem_ap(armv7m->debug_ap, mask, data);
+
+	for (unsigned int i = 0; i < sample_num_watches; i++) {
+		struct sample_watch *watch = &sample_watches[i];
+
+		if (!(mask & (1u << i)))
+			continue;
+
+		int retval = target_read_buffer(sample_target, watch->address, watch->size, data);
+		if (retval != ERROR_OK)
+			return retval;
+		data += watch->size;
+	}
+
+	return ERROR_OK;
+}
+
+static int sample_timer_callback(void *priv)
+{
+	if (!sample_clients || sample_num_watches == 0 || !sample_target)
+		return ERROR_OK;
+	if (!target_was_examined(sample_target))
+		return ERROR_OK;
+
+	uint32_t mask = sample_due_mask();
+	uint32_t size;
+	struct timeval now;
+
+	sample_tick++;
+	if (!mask)
+		return ERROR_OK;
+
+	if (sample_read(mask, sample_record + SAMPLE_HEADER_SIZE, &size) != ERROR_OK) {
+		LOG_DEBUG("sample: reading target memory failed, skipping sample");
+		return ERROR_OK;
+	}
+
+	uint32_t record_size = SAMPLE_HEADER_SIZE + size;
+
+	gettimeofday(&now, NULL);
+	h_u32_to_le(sample_record, record_size);
+	h_u32_to_le(sample_record + 4, sample_sequence++);
+	h_u64_to_le(sample_record + 8, (uint64_t)now.tv_sec * 1000000 + now.tv_usec);
+	h_u32_to_le(sample_record + 16, mask);
+
+	for (struct sample_client *client = sample_clients; client; client = client->next) {
+		if (client->connection->out_len > SAMPLE_MAX_PENDING) {
+			client->dropped++;
+			continue;
+		}
+		if (connection_write(client->connection, sample_record, record_size) < 0)
+			LOG_DEBUG("sample: write to client failed");
+	}
+
+	return ERROR_OK;
+}
+
+/* (Re)start the timer after the periods changed, if anybody is listening */
+static void sample_restart_timer(void)
+{
+	if (!sample_clients)
+		return;
+
+	target_unregister_timer_callback(sample_timer_callback, NULL);
+
+	sample_tick_ms = sample_num_watches ? 0 : sample_period_ms;
+	for (unsigned int i = 0; i < sample_num_watches; i++)
+		sample_tick_ms = sample_gcd(sample_tick_ms, sample_watch_period(&sample_watches[i]));
+	sample_tick = 0;
+
+	target_register_timer_callback(sample_timer_callback, sample_tick_ms,
+		TARGET_TIMER_TYPE_PERIODIC, NULL);
+}
+
+static int sample_new_connection(struct connection *connection)
+{
+	struct sample_client *client = calloc(1, sizeof(*client));
+
+	if (!client)
+		return ERROR_FAIL;
+
+	bool first = !sample_clients;
+
+	client->connection = connection;
+	client->next = sample_clients;
+	connection->priv = client;
+	sample_clients = client;
+
+	if (first)
+		sample_restart_timer();
+
+	LOG_DEBUG("sample: new connection");
+	return ERROR_OK;
+}
+
+static int sample_connection_closed(struct connection *connection)
+{
+	struct sample_client *client = connection->priv;
+
+	for (struct sample_client **p = &sample_clients; *p; p = &(*p)->next) {
+		if (*p == client) {
+			*p = client->next;
+			break;
+		}
+	}
+
+	if (client->dropped)
+		LOG_INFO("sample: client dropped %u records", client->dropped);
+	free(client);
+	connection->priv = NULL;
+
+	if (!sample_clients)
+		target_unregister_timer_callback(sample_timer_callback, NULL);
+
+	LOG_DEBUG("sample: connection closed");
+	return ERROR_OK;
+}
+
+static int sample_input(struct connection *connection)
+{
+	unsigned char buffer[256];
+	int bytes_read;
+
+	/* the stream is output only, anything received is discarded */
+	bytes_read = connection_read(connection, buffer, sizeof(buffer));
+
+	if (!bytes_read)
+		return ERROR_SERVER_REMOTE_CLOSED;
+	else if (bytes_read < 0) {
+		LOG_ERROR("error during read: %s", strerror(errno));
+		return ERROR_SERVER_REMOTE_CLOSED;
+	}
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_sample_add_command)
+{
+	target_addr_t address;
+	uint32_t size;
+	unsigned int period = 0;
+
+	if (CMD_ARGC != 2 && CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+	if (CMD_ARGC == 3) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[2], period);
+		if (period == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+
+	if (size == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	if (sample_num_watches == SAMPLE_MAX_WATCHES) {
+		command_print(CMD, "at most %d ranges can be sampled", SAMPLE_MAX_WATCHES);
+		return ERROR_FAIL;
+	}
+	if (size > SAMPLE_MAX_BYTES - sample_bytes) {
+		command_print(CMD, "at most %d bytes can be sampled", SAMPLE_MAX_BYTES);
+		return ERROR_FAIL;
+	}
+
+	sample_watches[sample_num_watches].address = address;
+	sample_watches[sample_num_watches].size = size;
+	sample_watches[sample_num_watches].period_ms = period;
+	sample_num_watches++;
+	sample_bytes += size;
+
+	sample_restart_timer();
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_sample_clear_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	sample_num_watches = 0;
+	sample_bytes = 0;
+
+	sample_restart_timer();
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_sample_list_command)
+{
+	if (CMD_ARGC != 0)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	for (unsigned int i = 0; i < sample_num_watches; i++)
+		command_print(CMD, "%u: " TARGET_ADDR_FMT " %" PRIu32 " %u ms", i,
+			sample_watches[i].address, sample_watches[i].size,
+			sample_watch_period(&sample_watches[i]));
+
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_sample_period_command)
+{
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (CMD_ARGC == 1) {
+		unsigned int period;
+
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[0], period);
+		if (period == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+		sample_period_ms = period;
+
+		sample_restart_timer();
+	}
+
+	command_print(CMD, "%u", sample_period_ms);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_sample_start_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	sample_target = get_current_target(CMD_CTX);
+
+	return add_service("sample", CMD_ARGV[0], CONNECTION_LIMIT_UNLIMITED,
+		sample_new_connection, sample_input, sample_connection_closed, NULL);
+}
+
+COMMAND_HANDLER(handle_sample_stop_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	remove_service("sample", CMD_ARGV[0]);
+
+	return ERROR_OK;
+}
+
+static const struct command_registration sample_server_subcommand_handlers[] = {
+	{
+		.name = "start",
+		.handler = handle_sample_start_command,
+		.mode = COMMAND_ANY,
+		.help = "Start a memory sampling server for the current target",
+		.usage = "<port>"
+	},
+	{
+		.name = "stop",
+		.handler = handle_sample_stop_command,
+		.mode = COMMAND_ANY,
+		.help = "Stop a memory sampling server",
+		.usage = "<port>"
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration sample_subcommand_handlers[] = {
+	{
+		.name = "server",
+		.mode = COMMAND_ANY,
+		.help = "memory sampling server",
+		.usage = "",
+		.chain = sample_server_subcommand_handlers
+	},
+	{
+		.name = "add",
+		.handler = handle_sample_add_command,
+		.mode = COMMAND_ANY,
+		.help = "Add a memory range to the sampled list",
+		.usage = "<address> <size> [milliseconds]"
+	},
+	{
+		.name = "clear",
+		.handler = handle_sample_clear_command,
+		.mode = COMMAND_ANY,
+		.help = "Remove all memory ranges from the sampled list",
+		.usage = ""
+	},
+	{
+		.name = "list",
+		.handler = handle_sample_list_command,
+		.mode = COMMAND_ANY,
+		.help = "List the sampled memory ranges",
+		.usage = ""
+	},
+	{
+		.name = "period",
+		.handler = handle_sample_period_command,
+		.mode = COMMAND_ANY,
+		.help = "Display or set the default sampling period in milliseconds",
+		.usage = "[milliseconds]"
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+static const struct command_registration sample_command_handlers[] = {
+	{
+		.name = "sample",
+		.mode = COMMAND_ANY,
+		.help = "live memory sampling",
+		.usage = "",
+		.chain = sample_subcommand_handlers
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+int sample_server_register_commands(struct command_context *ctx)
+{
+	return register_commands(ctx, NULL, sample_command_handlers);
+}
@@ -34,6 +34,7 @@
 #include "openocd.h"
 #include "tcl_server.h"
 #include "telnet_server.h"
+#include "read_scheduler.h"
 
 #include <signal.h>
 
@@ -41,6 +42,10 @@
 #include <netdb.h>
 #endif
 
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
 #ifndef _WIN32
 #include <netinet/tcp.h>
 #endif
@@ -64,6 +69,33 @@ static int polling_period = 100;
 /* address by name on which to listen for incoming TCP/IP connections */
 static char *bindto_name;
 
+/* connections that stop reading their output are dropped beyond this */
+#define CONNECTION_OUTPUT_MAX	(4 * 1024 * 1024)
+
+/* other connections get a turn this often during a long command */
+#define SERVER_YIELD_PERIOD_MS	20
+
+/* connection whose input server_loop() is handling, see server_yield() */
+static struct connection *server_current_connection;
+
+/*
+ * File descriptors waited on by server_loop(), rebuilt only when services
+ * or connections come and go. Each entry refers to either a service
+ * listening for connections or to a connection.
+ */
+struct server_fd {
+	int fd;
+	bool want_write;
+	bool readable;
+	bool writable;
+	struct service *service;
+	struct connection *connection;
+};
+
+static struct server_fd *server_fds;
+static unsigned int server_num_fds;
+static bool server_fds_changed = true;
+
 static int add_connection(struct service *service, struct command_context *cmd_ctx)
 {
 	socklen_t address_size;
@@ -78,6 +110,11 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	c->cmd_ctx = copy_command_context(cmd_ctx);
 	c->service = service;
 	c->input_pending = false;
+	c->out_buf = NULL;
+	c->out_len = 0;
+	c->out_size = 0;
+	c->readable = false;
+	c->writable = false;
 	c->priv = NULL;
 	c->next = NULL;
 
@@ -98,6 +135,9 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 			(char *)&flag,			/* the cast is historical cruft */
 			sizeof(int));			/* length of option value */
 
+		/* output that doesn't fit is queued, see connection_write() */
+		socket_nonblock(c->fd);
+
 		LOG_INFO("accepting '%s' connection on tcp/%s", service->name, service->port);
 		retval = service->new_connection(c);
 		if (retval != ERROR_OK) {
@@ -156,6 +196,7 @@ static int add_connection(struct service *service, struct command_context *cmd_c
 	for (p = &service->connections; *p; p = &(*p)->next)
 		;
 	*p = c;
+	server_fds_changed = true;
 
 	if (service->max_connections != CONNECTION_LIMIT_UNLIMITED)
 		service->max_connections--;
@@ -171,6 +212,11 @@ static int remove_connection(struct service *service, struct connection *connect
 	/* find connection */
 	while ((c = *p)) {
 		if (c->fd == connection->fd) {
+			/* last chance for queued output, without waiting for it */
+			if (connection_flush(c) != ERROR_OK || connection_output_pending(c))
+				LOG_DEBUG("dropping %zu bytes of '%s' connection output",
+					c->out_len, service->name);
+
 			service->connection_closed(c);
 			if (service->type == CONNECTION_TCP)
 				close_socket(c->fd);
@@ -183,7 +229,9 @@ static int remove_connection(struct service *service, struct connection *connect
 
 			/* delete connection */
 			*p = c->next;
+			free(c->out_buf);
 			free(c);
+			server_fds_changed = true;
 
 			if (service->max_connections != CONNECTION_LIMIT_UNLIMITED)
 				service->max_connections++;
@@ -226,8 +274,10 @@ int add_service(char *name,
 	c->connections = NULL;
 	c->new_connection = new_connection_handler;
 	c->input = input_handler;
+	c->yield_input = NULL;
 	c->connection_closed = connection_closed_handler;
 	c->priv = priv;
+	c->readable = false;
 	c->next = NULL;
 	long portnumber;
 	if (strcmp(c->port, "pipe") == 0)
@@ -346,6 +396,7 @@ int add_service(char *name,
 	for (p = &services; *p; p = &(*p)->next)
 		;
 	*p = c;
+	server_fds_changed = true;
 
 	return ERROR_OK;
 }
@@ -386,6 +437,7 @@ int remove_service(const char *name, const char *port)
 
 			free(tmp->priv);
 			free_service(tmp);
+			server_fds_changed = true;
 
 			return ERROR_OK;
 		}
@@ -394,6 +446,74 @@ int remove_service(const char *name, const char *port)
 	return ERROR_OK;
 }
 
+/**
+ * Let the connections of service @a name on @a port handle input while a
+ * command of another connection keeps server_loop() waiting, see
+ * server_yield().
+ */
+int service_set_yield_handler(const char *name, const char *port,
+		input_handler_t yield_handler)
+{
+	for (struct service *s = services; s; s = s->next) {
+		if (!strcmp(s->name, name) && !strcmp(s->port, port)) {
+			s->yield_input = yield_handler;
+			return ERROR_OK;
+		}
+	}
+
+	return ERROR_FAIL;
+}
+
+static bool server_fd_readable(int fd)
+{
+	struct timeval tv = { .tv_sec = 0, .tv_usec = 0 };
+	fd_set read_fds;
+
+	FD_ZERO(&read_fds);
+	FD_SET(fd, &read_fds);
+	return socket_select(fd + 1, &read_fds, NULL, NULL, &tv) > 0;
+}
+
+/**
+ * Give the other connections a turn from within a long command, such as
+ * dump_image on telnet, so that e.g. GDB can still step the target. Called
+ * at points where the command has no adapter work outstanding; does
+ * nothing more often than every SERVER_YIELD_PERIOD_MS, nor recursively.
+ *
+ * Only services with a yield handler take part, and the handler decides
+ * what is safe to do in the middle of another command. Connections are
+ * never removed here; errors are left for server_loop() to find.
+ */
+void server_yield(void)
+{
+	static bool yielding;
+	static int64_t last_yield;
+	int64_t now = timeval_ms();
+
+	if (yielding || now - last_yield < SERVER_YIELD_PERIOD_MS)
+		return;
+	last_yield = now;
+	yielding = true;
+
+	for (struct service *s = services; s; s = s->next) {
+		if (!s->yield_input || s->type != CONNECTION_TCP)
+			continue;
+
+		for (struct connection *c = s->connections; c; c = c->next) {
+			if (c == server_current_connection)
+				continue;
+			if (!c->input_pending && !server_fd_readable(c->fd))
+				continue;
+			/* whatever the wait in server_loop() saw may be consumed now */
+			c->readable = false;
+			s->yield_input(c);
+		}
+	}
+
+	read_scheduler_run();
+	yielding = false;
+}
+
 static int remove_services(void)
 {
 	struct service *c = services;
@@ -421,19 +541,126 @@ static int remove_services(void)
 
 	services = NULL;
 
+	free(server_fds);
+	server_fds = NULL;
+	server_num_fds = 0;
+	server_fds_changed = true;
+
+	return ERROR_OK;
+}
+
+/* Rebuild the list of file descriptors to wait on after services or
+ * connections changed. The service fd is -1 while it isn't listening. */
+static int server_update_fds(void)
+{
+	unsigned int num_fds = 0;
+
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1)
+			num_fds++;
+		for (struct connection *c = service->connections; c; c = c->next)
+			num_fds++;
+	}
+
+	struct server_fd *fds = realloc(server_fds, MAX(num_fds, 1) * sizeof(*fds));
+	if (!fds) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	server_fds = fds;
+	server_num_fds = 0;
+
+	for (struct service *service = services; service; service = service->next) {
+		if (service->fd != -1) {
+			fds[server_num_fds++] = (struct server_fd) {
+				.fd = service->fd,
+				.service = service,
+			};
+		}
+		for (struct connection *c = service->connections; c; c = c->next) {
+			fds[server_num_fds++] = (struct server_fd) {
+				.fd = c->fd,
+				.service = service,
+				.connection = c,
+			};
+		}
+	}
+
+	server_fds_changed = false;
 	return ERROR_OK;
 }
 
+/* Wait up to timeout_ms for any of server_fds to become ready.
+ * Returns the number of ready descriptors, 0 on timeout or -1 on error. */
+static int server_wait(int timeout_ms)
+{
+#ifdef HAVE_POLL_H
+	static struct pollfd *pfds;
+	static unsigned int pfds_size;
+
+	if (pfds_size < server_num_fds) {
+		struct pollfd *p = realloc(pfds, server_num_fds * sizeof(*p));
+		if (!p)
+			return -1;
+		pfds = p;
+		pfds_size = server_num_fds;
+	}
+
+	for (unsigned int i = 0; i < server_num_fds; i++) {
+		pfds[i].fd = server_fds[i].fd;
+		pfds[i].events = server_fds[i].want_write ? POLLIN | POLLOUT : POLLIN;
+		pfds[i].revents = 0;
+	}
+
+	int retval = poll(pfds, server_num_fds, timeout_ms);
+
+	for (unsigned int i = 0; i < server_num_fds; i++) {
+		/* errors and hangups are picked up by the following read */
+		server_fds[i].readable = retval > 0 && (pfds[i].revents & (POLLIN | POLLERR | POLLHUP));
+		server_fds[i].writable = retval > 0 && (pfds[i].revents & POLLOUT);
+	}
+#else
+	fd_set read_fds, write_fds;
+	int fd_max = 0;
+	struct timeval tv;
+
+	FD_ZERO(&read_fds);
+	FD_ZERO(&write_fds);
+	for (unsigned int i = 0; i < server_num_fds; i++) {
+		FD_SET(server_fds[i].fd, &read_fds);
+		if (server_fds[i].want_write)
+			FD_SET(server_fds[i].fd, &write_fds);
+		if (server_fds[i].fd > fd_max)
+			fd_max = server_fds[i].fd;
+	}
+
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+	int retval = socket_select(fd_max + 1, &read_fds, &write_fds, NULL, &tv);
+
+	/* eCos leaves the sets unchanged on timeout, so don't look at them then */
+	for (unsigned int i = 0; i < server_num_fds; i++) {
+		server_fds[i].readable = retval > 0 && FD_ISSET(server_fds[i].fd, &read_fds);
+		server_fds[i].writable = retval > 0 && FD_ISSET(server_fds[i].fd, &write_fds);
+	}
+
+#ifdef _WIN32
+	if (retval == -1)
+		errno = WSAGetLastError() == WSAEINTR ? EINTR : WSAGetLastError();
+#endif
+#endif
+
+	if (retval == -1 && errno == EINTR)
+		retval = 0;
+	return retval;
+}
+
 int server_loop(struct command_context *command_context)
 {
 	struct service *service;
 
 	bool poll_ok = true;
 
-	/* used in select() */
-	fd_set read_fds;
-	int fd_max;
-
 	/* used in accept() */
 	int retval;
 
@@ -445,39 +672,23 @@ int server_loop(struct command_context *command_context)
 #endif
 
 	while (shutdown_openocd == CONTINUE_MAIN_LOOP) {
-		/* monitor sockets for activity */
-		fd_max = 0;
-		FD_ZERO(&read_fds);
-
-		/* add service and connection fds to read_fds */
-		for (service = services; service; service = service->next) {
-			if (service->fd != -1) {
-				/* listen for new connections */
-				FD_SET(service->fd, &read_fds);
-
-				if (service->fd > fd_max)
-					fd_max = service->fd;
-			}
-
-			if (service->connections) {
-				struct connection *c;
+		if (server_fds_changed && server_update_fds() != ERROR_OK)
+			return ERROR_FAIL;
 
-				for (c = service->connections; c; c = c->next) {
-					/* check for activity on the connection */
-					FD_SET(c->fd, &read_fds);
-					if (c->fd > fd_max)
-						fd_max = c->fd;
-				}
-			}
+		/* only wait for writability where output is queued, and don't
+		 * wait at all while a connection has input left to process */
+		bool input_pending = false;
+		for (unsigned int i = 0; i < server_num_fds; i++) {
+			struct connection *c = server_fds[i].connection;
+			server_fds[i].want_write = c && c->fd_out == c->fd && connection_output_pending(c);
+			if (c && c->input_pending)
+				input_pending = true;
 		}
 
-		struct timeval tv;
-		tv.tv_sec = 0;
-		if (poll_ok) {
+		if (poll_ok || input_pending) {
 			/* we're just polling this iteration, this is faster on embedded
 			 * hosts */
-			tv.tv_usec = 0;
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(0);
 		} else {
 			/* Every 100ms, can be changed with "poll_period" command */
 			int timeout_ms = next_event - timeval_ms();
@@ -485,32 +696,36 @@ int server_loop(struct command_context *command_context)
 				timeout_ms = 0;
 			else if (timeout_ms > polling_period)
 				timeout_ms = polling_period;
-			tv.tv_usec = timeout_ms * 1000;
 			/* Only while we're sleeping we'll let others run */
 			kept_alive();
-			retval = socket_select(fd_max + 1, &read_fds, NULL, NULL, &tv);
+			retval = server_wait(timeout_ms);
 		}
 
 		if (retval == -1) {
-#ifdef _WIN32
-
-			errno = WSAGetLastError();
-
-			if (errno == WSAEINTR)
-				FD_ZERO(&read_fds);
-			else {
-				LOG_ERROR("error during select: %s", strerror(errno));
-				return ERROR_FAIL;
-			}
+			LOG_ERROR("error during %s: %s",
+#ifdef HAVE_POLL_H
+				"poll",
 #else
+				"select",
+#endif
+				strerror(errno));
+			return ERROR_FAIL;
+		}
 
-			if (errno == EINTR)
-				FD_ZERO(&read_fds);
-			else {
-				LOG_ERROR("error during select: %s", strerror(errno));
-				return ERROR_FAIL;
+		/* hand the results over to the services and connections; the
+		 * handlers below may add or remove any of them */
+		for (service = services; service; service = service->next) {
+			service->readable = false;
+			for (struct connection *c = service->connections; c; c = c->next)
+				c->readable = c->writable = false;
+		}
+		for (unsigned int i = 0; i < server_num_fds; i++) {
+			if (server_fds[i].connection) {
+				server_fds[i].connection->readable = server_fds[i].readable;
+				server_fds[i].connection->writable = server_fds[i].writable;
+			} else {
+				server_fds[i].service->readable = server_fds[i].readable;
 			}
-#endif
 		}
 
 		if (retval == 0) {
@@ -520,8 +735,6 @@ int server_loop(struct command_context *command_context)
 			next_event = target_timer_next_event();
 			process_jim_events(command_context);
 
-			FD_ZERO(&read_fds);	/* eCos leaves read_fds unchanged in this case!  */
-
 			/* We timed out/there was nothing to do, timeout rather than poll next time
 			 **/
 			poll_ok = false;
@@ -539,8 +752,8 @@ int server_loop(struct command_context *command_context)
 
 		for (service = services; service; service = service->next) {
 			/* handle new connections on listeners */
-			if ((service->fd != -1)
-				&& (FD_ISSET(service->fd, &read_fds))) {
+			if (service->fd != -1 && service->readable) {
+				service->readable = false;
 				if (service->max_connections != 0)
 					add_connection(service, command_context);
 				else {
@@ -564,28 +777,36 @@ int server_loop(struct command_context *command_context)
 				struct connection *c;
 
 				for (c = service->connections; c; ) {
-					if ((c->fd >= 0 && FD_ISSET(c->fd, &read_fds)) || c->input_pending) {
+					retval = ERROR_OK;
+					if (c->writable)
+						retval = connection_flush(c);
+					if (retval == ERROR_OK && ((c->fd >= 0 && c->readable) || c->input_pending)) {
+						server_current_connection = c;
 						retval = service->input(c);
-						if (retval != ERROR_OK) {
-							struct connection *next = c->next;
-							if (service->type == CONNECTION_PIPE ||
-									service->type == CONNECTION_STDINOUT) {
-								/* if connection uses a pipe then
-								 * shutdown openocd on error */
-								shutdown_openocd = SHUTDOWN_REQUESTED;
-							}
-							remove_connection(service, c);
-							LOG_INFO("dropped '%s' connection",
-								service->name);
-							c = next;
-							continue;
+						server_current_connection = NULL;
+					}
+					if (retval != ERROR_OK) {
+						struct connection *next = c->next;
+						if (service->type == CONNECTION_PIPE ||
+								service->type == CONNECTION_STDINOUT) {
+							/* if connection uses a pipe then
+							 * shutdown openocd on error */
+							shutdown_openocd = SHUTDOWN_REQUESTED;
 						}
+						remove_connection(service, c);
+						LOG_INFO("dropped '%s' connection",
+							service->name);
+						c = next;
+						continue;
 					}
 					c = c->next;
 				}
 			}
 		}
 
+		/* memory reads the connections asked for, issued together */
+		read_scheduler_run();
+
 #ifdef _WIN32
 		MSG msg;
 		while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE)) {
@@ -731,16 +952,95 @@ void exit_on_signal(int sig)
 #endif
 }
 
+static int connection_write_fd(struct connection *connection, const void *data, size_t len)
+{
+	if (connection->service->type == CONNECTION_TCP)
+		return write_socket(connection->fd_out, data, len);
+	else
+		return write(connection->fd_out, data, len);
+}
+
+static bool connection_would_block(struct connection *connection)
+{
+#ifdef _WIN32
+	if (connection->service->type == CONNECTION_TCP)
+		return WSAGetLastError() == WSAEWOULDBLOCK;
+#endif
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+/**
+ * Write to a connection without blocking. Whatever the connection doesn't
+ * accept right away is queued and written by server_loop() once it becomes
+ * writable, so a slow client can't stall the debugger. Returns @a len, or
+ * -1 if the connection failed or stopped taking its output altogether.
+ */
 int connection_write(struct connection *connection, const void *data, int len)
 {
+	int written = 0;
+
 	if (len == 0) {
 		/* successful no-op. Sockets and pipes behave differently here... */
 		return 0;
 	}
-	if (connection->service->type == CONNECTION_TCP)
-		return write_socket(connection->fd_out, data, len);
-	else
-		return write(connection->fd_out, data, len);
+
+	if (!connection_output_pending(connection)) {
+		written = connection_write_fd(connection, data, len);
+		if (written == len)
+			return len;
+		if (written < 0) {
+			if (!connection_would_block(connection))
+				return written;
+			written = 0;
+		}
+	}
+
+	size_t remaining = len - written;
+	if (connection->out_len + remaining > CONNECTION_OUTPUT_MAX) {
+		LOG_ERROR("'%s' connection is not reading its output", connection->service->name);
+		return -1;
+	}
+
+	if (connection->out_len + remaining > connection->out_size) {
+		size_t size = MAX(connection->out_size * 2, connection->out_len + remaining);
+		uint8_t *buf = realloc(connection->out_buf, size);
+		if (!buf) {
+			LOG_ERROR("Out of memory");
+			return -1;
+		}
+		connection->out_buf = buf;
+		connection->out_size = size;
+	}
+
+	memcpy(connection->out_buf + connection->out_len, (const uint8_t *)data + written, remaining);
+	connection->out_len += remaining;
+	return len;
+}
+
+/**
+ * Write as much of the queued output of a connection as it accepts
+ * without blocking.
+ */
+int connection_flush(struct connection *connection)
+{
+	size_t done = 0;
+
+	while (done < connection->out_len) {
+		int written = connection_write_fd(connection, connection->out_buf + done,
+				connection->out_len - done);
+		if (written <= 0) {
+			if (written < 0 && !connection_would_block(connection)) {
+				connection->out_len = 0;
+				return ERROR_SERVER_REMOTE_CLOSED;
+			}
+			break;
+		}
+		done += written;
+	}
+
+	memmove(connection->out_buf, connection->out_buf + done, connection->out_len - done);
+	connection->out_len -= done;
+	return ERROR_OK;
 }
 
 int connection_read(struct connection *connection, void *data, int len)
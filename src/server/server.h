@@ -51,6 +51,13 @@ struct connection {
 	struct command_context *cmd_ctx;
 	struct service *service;
 	bool input_pending;
+	/* output that could not be written without blocking, see connection_write() */
+	uint8_t *out_buf;
+	size_t out_len;
+	size_t out_size;
+	/* events seen by the last wait in server_loop() */
+	bool readable;
+	bool writable;
 	void *priv;
 	struct connection *next;
 };
@@ -70,8 +77,11 @@ struct service {
 	struct connection *connections;
 	new_connection_handler_t new_connection;
 	input_handler_t input;
+	/* input handler for server_yield(), NULL if the service doesn't take part */
+	input_handler_t yield_input;
 	connection_closed_handler_t connection_closed;
 	void *priv;
+	bool readable;	/* new connection pending on fd */
 	struct service *next;
 };
 
@@ -80,6 +90,8 @@ int add_service(char *name, const char *port,
 		input_handler_t in_handler, connection_closed_handler_t close_handler,
 		void *priv);
 int remove_service(const char *name, const char *port);
+int service_set_yield_handler(const char *name, const char *port,
+		input_handler_t yield_handler);
 
 int server_host_os_entry(void);
 int server_host_os_close(void);
@@ -91,11 +103,19 @@ void server_free(void);
 void exit_on_signal(int sig);
 
 int server_loop(struct command_context *command_context);
+void server_yield(void);
 
 int server_register_commands(struct command_context *context);
 
 int connection_write(struct connection *connection, const void *data, int len);
 int connection_read(struct connection *connection, void *data, int len);
+int connection_flush(struct connection *connection);
+
+/** @returns true if output of @a connection is still waiting to be written */
+static inline bool connection_output_pending(struct connection *connection)
+{
+	return connection->out_len > 0;
+}
 
 /**
  * Defines an extended command handler function declaration to enable
@@ -22,11 +22,25 @@
 
 #include "tcl_server.h"
 #include <target/target.h>
+#include <target/memory_cache.h>
 #include <helper/binarybuffer.h>
 
 #define TCL_SERVER_VERSION		"TCL Server 0.1"
 #define TCL_LINE_INITIAL		(4*1024)
 #define TCL_LINE_MAX			(4*1024*1024)
+#define TCL_INPUT_SIZE			(4*1024)
+
+/* Binary framing, see tcl_binary. Every request and reply starts with a
+ * little-endian 32-bit length of the rest of the frame, followed by the
+ * 32-bit request id and a type (requests) or status (replies) byte. */
+#define TCL_BINARY_HEADER_SIZE	9
+#define TCL_BINARY_COMMAND		0	/* payload: Tcl command, reply: result */
+#define TCL_BINARY_READ			1	/* payload: u64 address, u32 size, reply: data */
+#define TCL_BINARY_WRITE		2	/* payload: u64 address, data, reply: empty */
+
+#define TCL_BINARY_OK			0
+#define TCL_BINARY_ERROR		1	/* payload: error message */
+#define TCL_BINARY_NOTIFY		2	/* unsolicited notification, id 0xffffffff */
 
 struct tcl_connection {
 	int tc_linedrop;
@@ -37,6 +51,11 @@ struct tcl_connection {
 	enum target_state tc_laststate;
 	bool tc_notify;
 	bool tc_trace;
+	bool tc_binary;
+	/* input read from the socket, processed one command at a time */
+	unsigned char tc_in[TCL_INPUT_SIZE];
+	int tc_in_len;
+	int tc_in_pos;
 };
 
 static char *tcl_port;
@@ -46,6 +65,19 @@ static int tcl_new_connection(struct connection *connection);
 static int tcl_input(struct connection *connection);
 static int tcl_output(struct connection *connection, const void *buf, ssize_t len);
 static int tcl_closed(struct connection *connection);
+static int tcl_binary_reply(struct connection *connection, uint32_t id, uint8_t status,
+		const void *data, uint32_t len);
+
+/* Send a "\r\n\x1a" terminated notification; in binary mode as a frame holding
+ * just the text, without the terminator */
+static int tcl_notify(struct connection *connection, const char *buf, size_t len)
+{
+	struct tcl_connection *tclc = connection->priv;
+
+	if (tclc->tc_binary)
+		return tcl_binary_reply(connection, 0xffffffff, TCL_BINARY_NOTIFY, buf, len - 3);
+	return tcl_output(connection, buf, len);
+}
 
 static int tcl_target_callback_event_handler(struct target *target,
 		enum target_event event, void *priv)
@@ -58,14 +90,14 @@ static int tcl_target_callback_event_handler(struct target *target,
 
 	if (tclc->tc_notify) {
 		snprintf(buf, sizeof(buf), "type target_event event %s\r\n\x1a", target_event_name(event));
-		tcl_output(connection, buf, strlen(buf));
+		tcl_notify(connection, buf, strlen(buf));
 	}
 
 	if (tclc->tc_laststate != target->state) {
 		tclc->tc_laststate = target->state;
 		if (tclc->tc_notify) {
 			snprintf(buf, sizeof(buf), "type target_state state %s\r\n\x1a", target_state_name(target));
-			tcl_output(connection, buf, strlen(buf));
+			tcl_notify(connection, buf, strlen(buf));
 		}
 	}
 
@@ -83,7 +115,7 @@ static int tcl_target_callback_reset_handler(struct target *target,
 
 	if (tclc->tc_notify) {
 		snprintf(buf, sizeof(buf), "type target_reset mode %s\r\n\x1a", target_reset_mode_name(reset_mode));
-		tcl_output(connection, buf, strlen(buf));
+		tcl_notify(connection, buf, strlen(buf));
 	}
 
 	return ERROR_OK;
@@ -107,7 +139,7 @@ static int tcl_target_callback_trace_handler(struct target *target,
 		buf = malloc(max_len);
 		hexify(hex, data, len, hex_len);
 		snprintf(buf, max_len, "%s%s%s", header, hex, trailer);
-		tcl_output(connection, buf, strlen(buf));
+		tcl_notify(connection, buf, strlen(buf));
 		free(hex);
 		free(buf);
 	}
@@ -117,8 +149,9 @@ static int tcl_target_callback_trace_handler(struct target *target,
 
 /* write data out to a socket.
  *
- * this is a blocking write, so the return value must equal the length, if
- * that is not the case then flag the connection with an output error.
+ * connection_write() queues whatever the socket doesn't take right away, so
+ * the return value must equal the length; if that is not the case the
+ * connection failed, so flag it with an output error.
  */
 int tcl_output(struct connection *connection, const void *data, ssize_t len)
 {
@@ -171,6 +204,143 @@ static int tcl_new_connection(struct connection *connection)
 	return ERROR_OK;
 }
 
+static int tcl_binary_reply(struct connection *connection, uint32_t id, uint8_t status,
+		const void *data, uint32_t len)
+{
+	uint8_t header[TCL_BINARY_HEADER_SIZE];
+	int retval;
+
+	h_u32_to_le(header, len + TCL_BINARY_HEADER_SIZE - 4);
+	h_u32_to_le(header + 4, id);
+	header[8] = status;
+
+	retval = tcl_output(connection, header, sizeof(header));
+	if (retval != ERROR_OK || len == 0)
+		return retval;
+	return tcl_output(connection, data, len);
+}
+
+static int tcl_binary_error(struct connection *connection, uint32_t id, const char *msg)
+{
+	return tcl_binary_reply(connection, id, TCL_BINARY_ERROR, msg, strlen(msg));
+}
+
+/* Run one complete binary request; the frame is in tc_line, with room
+ * for a terminating zero after it */
+static int tcl_binary_request(struct connection *connection, uint8_t *frame, uint32_t len)
+{
+	Jim_Interp *interp = (Jim_Interp *)connection->cmd_ctx->interp;
+	uint32_t id = le_to_h_u32(frame);
+	uint8_t type = frame[4];
+	uint8_t *payload = frame + 5;
+	uint32_t payload_len = len - 5;
+	struct target *target;
+	target_addr_t address;
+	int retval;
+
+	switch (type) {
+		case TCL_BINARY_COMMAND: {
+			const char *result;
+			int reslen;
+
+			payload[payload_len] = '\0';
+			retval = command_run_line(connection->cmd_ctx, (char *)payload);
+			result = Jim_GetString(Jim_GetResult(interp), &reslen);
+			return tcl_binary_reply(connection, id,
+				retval == ERROR_OK ? TCL_BINARY_OK : TCL_BINARY_ERROR, result, reslen);
+		}
+		case TCL_BINARY_READ: {
+			if (payload_len != 12)
+				return tcl_binary_error(connection, id, "malformed read request");
+
+			target = get_current_target_or_null(connection->cmd_ctx);
+			if (!target)
+				return tcl_binary_error(connection, id, "no current target");
+
+			address = le_to_h_u64(payload);
+			uint32_t size = le_to_h_u32(payload + 8);
+			if (size > TCL_LINE_MAX)
+				return tcl_binary_error(connection, id, "read request too large");
+
+			uint8_t *data = malloc(size);
+			if (!data)
+				return tcl_binary_error(connection, id, "out of memory");
+
+			retval = target_read_memory_cached(target, address, size, data);
+			if (retval == ERROR_OK)
+				retval = tcl_binary_reply(connection, id, TCL_BINARY_OK, data, size);
+			else
+				retval = tcl_binary_error(connection, id, "cannot read memory");
+			free(data);
+			return retval;
+		}
+		case TCL_BINARY_WRITE:
+			if (payload_len < 8)
+				return tcl_binary_error(connection, id, "malformed write request");
+
+			target = get_current_target_or_null(connection->cmd_ctx);
+			if (!target)
+				return tcl_binary_error(connection, id, "no current target");
+
+			address = le_to_h_u64(payload);
+			retval = target_write_buffer(target, address, payload_len - 8, payload + 8);
+			if (retval != ERROR_OK)
+				return tcl_binary_error(connection, id, "cannot write memory");
+			return tcl_binary_reply(connection, id, TCL_BINARY_OK, NULL, 0);
+		default:
+			return tcl_binary_error(connection, id, "unknown request type");
+	}
+}
+
+/* Collect the next binary frame from tc_in into tc_line and run it */
+static int tcl_input_binary(struct connection *connection)
+{
+	struct tcl_connection *tclc = connection->priv;
+	uint32_t frame_size = 4;
+	int retval;
+
+	while (tclc->tc_in_pos < tclc->tc_in_len) {
+		if (tclc->tc_lineoffset >= 4) {
+			uint32_t len = le_to_h_u32((uint8_t *)tclc->tc_line);
+
+			if (len < TCL_BINARY_HEADER_SIZE - 4 || len > TCL_LINE_MAX) {
+				LOG_ERROR("tcl: invalid binary frame length %" PRIu32 ", dropping connection", len);
+				return ERROR_SERVER_REMOTE_CLOSED;
+			}
+			frame_size = 4 + len;
+
+			/* room for the frame plus a terminating zero */
+			if ((uint32_t)tclc->tc_line_size < frame_size + 1) {
+				char *line = realloc(tclc->tc_line, frame_size + 1);
+				if (!line) {
+					LOG_ERROR("Out of memory");
+					return ERROR_SERVER_REMOTE_CLOSED;
+				}
+				tclc->tc_line = line;
+				tclc->tc_line_size = frame_size + 1;
+			}
+		}
+
+		uint32_t count = MIN(frame_size - tclc->tc_lineoffset,
+				(uint32_t)(tclc->tc_in_len - tclc->tc_in_pos));
+		memcpy(tclc->tc_line + tclc->tc_lineoffset, tclc->tc_in + tclc->tc_in_pos, count);
+		tclc->tc_lineoffset += count;
+		tclc->tc_in_pos += count;
+
+		if (frame_size > 4 && (uint32_t)tclc->tc_lineoffset == frame_size) {
+			tclc->tc_lineoffset = 0;
+			retval = tcl_binary_request(connection, (uint8_t *)tclc->tc_line + 4, frame_size - 4);
+			if (retval != ERROR_OK)
+				return retval;
+			/* one request per call, like text commands */
+			break;
+		}
+	}
+
+	connection->input_pending = tclc->tc_in_pos < tclc->tc_in_len;
+	return ERROR_OK;
+}
+
 static int tcl_input(struct connection *connection)
 {
 	Jim_Interp *interp = (Jim_Interp *)connection->cmd_ctx->interp;
@@ -180,25 +350,37 @@ static int tcl_input(struct connection *connection)
 	const char *result;
 	int reslen;
 	struct tcl_connection *tclc;
-	unsigned char in[256];
+	unsigned char in;
 	char *tc_line_new;
 	int tc_line_size_new;
 
-	rlen = connection_read(connection, &in, sizeof(in));
-	if (rlen <= 0) {
-		if (rlen < 0)
-			LOG_ERROR("error during read: %s", strerror(errno));
-		return ERROR_SERVER_REMOTE_CLOSED;
-	}
-
 	tclc = connection->priv;
 	if (!tclc)
 		return ERROR_CONNECTION_REJECTED;
 
-	/* push as much data into the line as possible */
-	for (i = 0; i < rlen; i++) {
+	/* only read more once everything read before has been processed */
+	if (tclc->tc_in_pos == tclc->tc_in_len) {
+		rlen = connection_read(connection, tclc->tc_in, sizeof(tclc->tc_in));
+		if (rlen <= 0) {
+			if (rlen < 0)
+				LOG_ERROR("error during read: %s", strerror(errno));
+			return ERROR_SERVER_REMOTE_CLOSED;
+		}
+		tclc->tc_in_len = rlen;
+		tclc->tc_in_pos = 0;
+	}
+
+	if (tclc->tc_binary)
+		return tcl_input_binary(connection);
+
+	/* push as much data into the line as possible, up to the end of the
+	 * first command. Further commands are left for the next call, so that
+	 * a client sending many commands at once doesn't hold off other
+	 * connections until all of them have run. */
+	for (i = tclc->tc_in_pos; i < tclc->tc_in_len; i++) {
+		in = tclc->tc_in[i];
 		/* buffer the data */
-		tclc->tc_line[tclc->tc_lineoffset] = in[i];
+		tclc->tc_line[tclc->tc_lineoffset] = in;
 		if (tclc->tc_lineoffset + 1 < tclc->tc_line_size) {
 			tclc->tc_lineoffset++;
 		} else if (tclc->tc_line_size >= TCL_LINE_MAX) {
@@ -229,7 +411,7 @@ static int tcl_input(struct connection *connection)
 		 * press ctrl-z a couple of times first to put telnet into the
 		 * mode where it will send 0x1a in response to pressing ctrl-z
 		 */
-		if (in[i] != '\x1a')
+		if (in != '\x1a')
 			continue;
 
 		/* process the line */
@@ -252,8 +434,13 @@ static int tcl_input(struct connection *connection)
 
 		tclc->tc_lineoffset = 0;
 		tclc->tc_linedrop = 0;
+		i++;
+		break;
 	}
 
+	tclc->tc_in_pos = i;
+	connection->input_pending = tclc->tc_in_pos < tclc->tc_in_len;
+
 	return ERROR_OK;
 }
 
@@ -310,6 +497,23 @@ COMMAND_HANDLER(handle_tcl_notifications_command)
 	}
 }
 
+COMMAND_HANDLER(handle_tcl_binary_command)
+{
+	struct connection *connection = NULL;
+	struct tcl_connection *tclc = NULL;
+
+	if (CMD_CTX->output_handler_priv)
+		connection = CMD_CTX->output_handler_priv;
+
+	if (connection && !strcmp(connection->service->name, "tcl")) {
+		tclc = connection->priv;
+		return CALL_COMMAND_HANDLER(handle_command_parse_bool, &tclc->tc_binary, "Binary framing ");
+	} else {
+		LOG_ERROR("%s: can only be called from the tcl server", CMD_NAME);
+		return ERROR_COMMAND_SYNTAX_ERROR;
+	}
+}
+
 COMMAND_HANDLER(handle_tcl_trace_command)
 {
 	struct connection *connection = NULL;
@@ -344,6 +548,13 @@ static const struct command_registration tcl_command_handlers[] = {
 		.help = "Target Notification output",
 		.usage = "[on|off]",
 	},
+	{
+		.name = "tcl_binary",
+		.handler = handle_tcl_binary_command,
+		.mode = COMMAND_EXEC,
+		.help = "Binary framing of requests and replies",
+		.usage = "[on|off]",
+	},
 	{
 		.name = "tcl_trace",
 		.handler = handle_tcl_trace_command,
@@ -0,0 +1,95 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <jtag/adapter_stats.h>
+
+#include "target.h"
+#include "adapter_stats_dump.h"
+
+/*
+ * Periodic dump of the adapter statistics, "adapter stats dump".
+ *
+ * The statistics are kept by the jtag layer; appending them to a file at a
+ * fixed interval needs the target timer callbacks, so this part of the
+ * "adapter stats" command is registered from the target layer.
+ */
+
+static FILE *adapter_stats_dump_file;
+
+static int adapter_stats_dump_callback(void *priv)
+{
+	static char json[ADAPTER_STATS_JSON_SIZE];
+
+	if (adapter_stats_dump_file) {
+		adapter_stats_format(json, sizeof(json));
+		fprintf(adapter_stats_dump_file, "%s\n", json);
+		fflush(adapter_stats_dump_file);
+	}
+	return ERROR_OK;
+}
+
+void adapter_stats_dump_stop(void)
+{
+	if (!adapter_stats_dump_file)
+		return;
+
+	target_unregister_timer_callback(adapter_stats_dump_callback, NULL);
+	fclose(adapter_stats_dump_file);
+	adapter_stats_dump_file = NULL;
+}
+
+COMMAND_HANDLER(handle_adapter_stats_dump_command)
+{
+	if (CMD_ARGC == 1 && !strcmp(CMD_ARGV[0], "off")) {
+		adapter_stats_dump_stop();
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	unsigned int period_ms;
+	COMMAND_PARSE_NUMBER(uint, CMD_ARGV[1], period_ms);
+	if (period_ms == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	adapter_stats_dump_stop();
+
+	adapter_stats_dump_file = fopen(CMD_ARGV[0], "a");
+	if (!adapter_stats_dump_file) {
+		command_print(CMD, "cannot open %s: %s", CMD_ARGV[0], strerror(errno));
+		return ERROR_FAIL;
+	}
+
+	return target_register_timer_callback(adapter_stats_dump_callback, period_ms,
+			TARGET_TIMER_TYPE_PERIODIC, NULL);
+}
+
+const struct command_registration adapter_stats_dump_command_handlers[] = {
+	{
+		.name = "dump",
+		.handler = handle_adapter_stats_dump_command,
+		.mode = COMMAND_ANY,
+		.help = "append the adapter statistics to a file periodically, "
+			"or stop doing so",
+		.usage = "(filename milliseconds | 'off')",
+	},
+	COMMAND_REGISTRATION_DONE
+};
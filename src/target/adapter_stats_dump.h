@@ -0,0 +1,27 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_ADAPTER_STATS_DUMP_H
+#define OPENOCD_TARGET_ADAPTER_STATS_DUMP_H
+
+#include <helper/command.h>
+
+/** Registered with the prefix "adapter stats" */
+extern const struct command_registration adapter_stats_dump_command_handlers[];
+
+/** Stop the periodic dump of the adapter statistics. */
+void adapter_stats_dump_stop(void);
+
+#endif /* OPENOCD_TARGET_ADAPTER_STATS_DUMP_H */
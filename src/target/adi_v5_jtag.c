@@ -39,6 +39,7 @@
 #include <helper/time_support.h>
 #include <helper/list.h>
 #include <jtag/swd.h>
+#include <jtag/adapter_stats.h>
 
 /*#define DEBUG_WAIT*/
 
@@ -725,8 +726,10 @@ static int jtag_ap_q_bankselect(struct adiv5_ap *ap, unsigned reg)
 	struct adiv5_dap *dap = ap->dap;
 	uint32_t sel = ((uint32_t)ap->ap_num << 24) | (reg & 0x000000F0);
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		adapter_stats_count(ADAPTER_STATS_BANKSEL_AVOIDED, 1);
 		return ERROR_OK;
+	}
 
 	dap->select = sel;
 
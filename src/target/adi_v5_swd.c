@@ -52,6 +52,7 @@
 #include <jtag/interface.h>
 
 #include <jtag/swd.h>
+#include <jtag/adapter_stats.h>
 
 /* for debug, set do_sync to true to force synchronous transfers */
 static bool do_sync;
@@ -93,8 +94,11 @@ static int swd_run_inner(struct adiv5_dap *dap)
 {
 	const struct swd_driver *swd = adiv5_dap_swd_driver(dap);
 	int retval;
+	int64_t start = adapter_stats_start();
 
+	jtag_count_flush();
 	retval = swd->run();
+	adapter_stats_flush_done(start);
 
 	if (retval != ERROR_OK) {
 		/* fault response */
@@ -120,8 +124,10 @@ static int swd_queue_dp_bankselect(struct adiv5_dap *dap, unsigned int reg)
 	uint32_t sel = select_dp_bank
 			| (dap->select & (DP_SELECT_APSEL | DP_SELECT_APBANK));
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		adapter_stats_count(ADAPTER_STATS_BANKSEL_AVOIDED, 1);
 		return ERROR_OK;
+	}
 
 	dap->select = sel;
 
@@ -478,8 +484,10 @@ static int swd_queue_ap_bankselect(struct adiv5_ap *ap, unsigned reg)
 			| (reg & 0x000000F0)
 			| (dap->select & DP_SELECT_DPBANK);
 
-	if (sel == dap->select)
+	if (sel == dap->select) {
+		adapter_stats_count(ADAPTER_STATS_BANKSEL_AVOIDED, 1);
 		return ERROR_OK;
+	}
 
 	dap->select = sel;
 
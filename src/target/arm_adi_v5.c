@@ -255,6 +255,53 @@ int mem_ap_read_u32(struct adiv5_ap *ap, target_addr_t address,
 	return dap_queue_ap_read(ap, MEM_AP_REG_BD0 | (address & 0xC), value);
 }
 
+/**
+ * Asynchronous (queued) read of consecutive words from memory.
+ *
+ * Unlike mem_ap_read_buf(), this does not flush the queue, so reads of
+ * several blocks can share one dap_run(). The caller must call dap_run()
+ * before @a values goes out of scope, also when this function fails part
+ * way through queueing.
+ *
+ * @param ap The MEM-AP to access.
+ * @param values points to where the words will be stored, in host byte
+ *	order, when the transaction queue is flushed.
+ * @param count The number of words to read.
+ * @param address Address of the first word; it must be word aligned.
+ *
+ * @return ERROR_OK for success.  Otherwise a fault code.
+ */
+int mem_ap_read_buf_u32_queued(struct adiv5_ap *ap, uint32_t *values,
+		uint32_t count, target_addr_t address)
+{
+	int retval;
+
+	if (address & 3)
+		return ERROR_TARGET_UNALIGNED_ACCESS;
+	/* the byte lanes would need to be swapped, see mem_ap_read() */
+	if (ap->dap->ti_be_32_quirks)
+		return ERROR_NOT_IMPLEMENTED;
+
+	retval = mem_ap_setup_csw(ap, CSW_32BIT | CSW_ADDRINC_SINGLE);
+	if (retval != ERROR_OK)
+		return retval;
+
+	while (count--) {
+		retval = mem_ap_setup_tar(ap, address);
+		if (retval != ERROR_OK)
+			return retval;
+
+		retval = dap_queue_ap_read(ap, MEM_AP_REG_DRW, values++);
+		if (retval != ERROR_OK)
+			return retval;
+
+		address += 4;
+		mem_ap_update_tar_cache(ap);
+	}
+
+	return ERROR_OK;
+}
+
 /**
  * Synchronous read of a word from memory or a system register.
  * As a side effect, this flushes any queued transactions.
@@ -404,7 +451,11 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 		 * depends on the type of transfer and alignment. See ARM document IHI0031C. */
 		uint32_t outvalue = 0;
 		uint32_t drw_byte_idx = address;
-		if (dap->ti_be_32_quirks) {
+		if (this_size == 4 && (address & 3) == 0 && !dap->ti_be_32_quirks) {
+			/* whole word in its natural byte lanes */
+			outvalue = le_to_h_u32(buffer);
+			buffer += 4;
+		} else if (dap->ti_be_32_quirks) {
 			switch (this_size) {
 			case 4:
 				outvalue |= (uint32_t)*buffer++ << 8 * (3 ^ (drw_byte_idx++ & 3) ^ addr_xor);
@@ -460,6 +511,26 @@ static int mem_ap_write(struct adiv5_ap *ap, const uint8_t *buffer, uint32_t siz
 	return retval;
 }
 
+/* Make sure the DAP's scratch buffer holds at least count DRW words. */
+static int mem_ap_reserve_read_buf(struct adiv5_dap *dap, uint32_t count)
+{
+	if (dap->read_buf_count >= count)
+		return ERROR_OK;
+
+	/* Multiplication count * sizeof(uint32_t) may overflow on 32-bit hosts */
+	size_t bytes = (size_t)count * sizeof(uint32_t);
+	uint32_t *read_buf = NULL;
+	if (bytes / sizeof(uint32_t) == count)
+		read_buf = realloc(dap->read_buf, bytes);
+	if (!read_buf) {
+		LOG_ERROR("Failed to allocate read buffer");
+		return ERROR_FAIL;
+	}
+	dap->read_buf = read_buf;
+	dap->read_buf_count = count;
+	return ERROR_OK;
+}
+
 /**
  * Synchronous read of a block of memory, using a specific access size.
  *
@@ -501,16 +572,23 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 	if (ap->unaligned_access_bad && (adr % size != 0))
 		return ERROR_TARGET_UNALIGNED_ACCESS;
 
-	/* Allocate buffer to hold the sequence of DRW reads that will be made. This is a significant
-	 * over-allocation if packed transfers are going to be used, but determining the real need at
-	 * this point would be messy. */
-	uint32_t *read_buf = calloc(count, sizeof(uint32_t));
-	/* Multiplication count * sizeof(uint32_t) may overflow, calloc() is safe */
-	uint32_t *read_ptr = read_buf;
-	if (!read_buf) {
-		LOG_ERROR("Failed to allocate read buffer");
-		return ERROR_FAIL;
+	/* When every transfer moves a whole, aligned little-endian word, the DRW reads can be
+	 * stored straight into the caller's buffer. Otherwise they go to the DAP's scratch buffer,
+	 * one word per transfer, and are unpacked afterwards. The scratch buffer is sized for the
+	 * worst case of one transfer per unit, but it is kept and reused for the next read. */
+	bool in_place = !dap->ti_be_32_quirks && ((uintptr_t)buffer & 3) == 0 && (adr & 3) == 0
+		&& (size == 4 || (addrinc && ap->packed_transfers && (size * count) % 4 == 0));
+
+	uint32_t *read_buf;
+	if (in_place) {
+		read_buf = (uint32_t *)buffer;
+	} else {
+		retval = mem_ap_reserve_read_buf(dap, count);
+		if (retval != ERROR_OK)
+			return retval;
+		read_buf = dap->read_buf;
 	}
+	uint32_t *read_ptr = read_buf;
 
 	/* Queue up all reads. Each read will store the entire DRW word in the read buffer. How many
 	 * useful bytes it contains, and their location in the word, depends on the type of transfer
@@ -544,8 +622,12 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		mem_ap_update_tar_cache(ap);
 	}
 
+	/* Reads queued before a failure still point into read_buf, which outlives this call;
+	 * flush them now rather than let a later dap_run() complete them. */
 	if (retval == ERROR_OK)
 		retval = dap_run(dap);
+	else
+		dap_run(dap);
 
 	/* Restore state */
 	address = adr;
@@ -567,6 +649,14 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		}
 	}
 
+	if (in_place) {
+#ifdef WORDS_BIGENDIAN
+		for (size_t i = 0; i < nbytes / 4; i++)
+			h_u32_to_le(buffer + 4 * i, read_buf[i]);
+#endif
+		return retval;
+	}
+
 	/* Replay loop to populate caller's buffer from the correct word and byte lane */
 	while (nbytes > 0) {
 		uint32_t this_size = size;
@@ -606,7 +696,6 @@ static int mem_ap_read(struct adiv5_ap *ap, uint8_t *buffer, uint32_t size, uint
 		nbytes -= this_size;
 	}
 
-	free(read_buf);
 	return retval;
 }
 
@@ -314,6 +314,14 @@ struct adiv5_dap {
 	 */
 	uint32_t *last_read;
 
+	/**
+	 * Scratch buffer for the DRW words of MEM-AP reads that cannot land
+	 * directly in the caller's buffer. Grown as needed and reused.
+	 */
+	uint32_t *read_buf;
+	/* number of words allocated in read_buf */
+	size_t read_buf_count;
+
 	/* The TI TMS470 and TMS570 series processors use a BE-32 memory ordering
 	 * despite lack of support in the ARMv7 architecture. Memory access through
 	 * the AHB-AP has strange byte ordering these processors, and we need to
@@ -593,6 +601,10 @@ int mem_ap_read_u32(struct adiv5_ap *ap,
 int mem_ap_write_u32(struct adiv5_ap *ap,
 		target_addr_t address, uint32_t value);
 
+/* Queued MEM-AP memory mapped block of word reads. */
+int mem_ap_read_buf_u32_queued(struct adiv5_ap *ap,
+		uint32_t *values, uint32_t count, target_addr_t address);
+
 /* Synchronous MEM-AP memory mapped single word transfers. */
 int mem_ap_read_atomic_u32(struct adiv5_ap *ap,
 		target_addr_t address, uint32_t *value);
@@ -145,6 +145,7 @@ int dap_cleanup_all(void)
 		if (dap->ops && dap->ops->quit)
 			dap->ops->quit(dap);
 
+		free(dap->read_buf);
 		free(obj->name);
 		free(obj);
 	}
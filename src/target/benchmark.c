@@ -0,0 +1,314 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/log.h>
+#include <helper/time_support.h>
+#include <jtag/jtag.h>
+
+#include "target.h"
+#include "register.h"
+#include "benchmark.h"
+
+/*
+ * Benchmarks of the adapter bound paths.
+ *
+ * Every benchmark prints one JSON object with the amount of data moved,
+ * the wall time and the number of adapter queue flushes (round trips), so
+ * a script can collect the results and compare them between builds.
+ */
+
+struct benchmark {
+	const char *name;
+	uint64_t bytes;
+	unsigned int iterations;
+	struct duration duration;
+	int flushes;
+};
+
+static void benchmark_start(struct benchmark *bench, const char *name)
+{
+	bench->name = name;
+	bench->bytes = 0;
+	bench->iterations = 0;
+	bench->flushes = jtag_get_flush_queue_count();
+	duration_start(&bench->duration);
+}
+
+static int benchmark_report(struct command_invocation *cmd, struct benchmark *bench)
+{
+	int retval = duration_measure(&bench->duration);
+	if (retval != ERROR_OK)
+		return retval;
+
+	int flushes = jtag_get_flush_queue_count() - bench->flushes;
+	double seconds = duration_elapsed(&bench->duration);
+
+	command_print(cmd, "{\"name\": \"%s\", \"iterations\": %u, \"bytes\": %" PRIu64
+			", \"seconds\": %.6f, \"bytes_per_second\": %.1f"
+			", \"round_trips\": %d, \"round_trips_per_iteration\": %.2f}",
+			bench->name, bench->iterations, bench->bytes, seconds,
+			seconds > 0 ? bench->bytes / seconds : 0,
+			flushes, bench->iterations ? (double)flushes / bench->iterations : 0);
+	return ERROR_OK;
+}
+
+static COMMAND_HELPER(benchmark_parse_iterations, unsigned int index,
+		unsigned int *iterations)
+{
+	*iterations = 1;
+	if (CMD_ARGC > index) {
+		COMMAND_PARSE_NUMBER(uint, CMD_ARGV[index], *iterations);
+		if (*iterations == 0)
+			return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	return ERROR_OK;
+}
+
+static int benchmark_check_halted(struct command_invocation *cmd, struct target *target)
+{
+	if (target->state != TARGET_HALTED) {
+		command_print(cmd, "target %s is not halted", target_name(target));
+		return ERROR_TARGET_NOT_HALTED;
+	}
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_benchmark_read_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct benchmark bench;
+	target_addr_t address;
+	unsigned int iterations;
+	uint32_t size;
+
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+	int retval = CALL_COMMAND_HANDLER(benchmark_parse_iterations, 2, &iterations);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint8_t *buffer = malloc(size);
+	if (!buffer) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	benchmark_start(&bench, "read");
+	for (unsigned int i = 0; i < iterations && retval == ERROR_OK; i++) {
+		retval = target_read_buffer(target, address, size, buffer);
+		bench.bytes += size;
+		bench.iterations++;
+	}
+	free(buffer);
+
+	if (retval != ERROR_OK)
+		return retval;
+	return benchmark_report(CMD, &bench);
+}
+
+COMMAND_HANDLER(handle_benchmark_write_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct benchmark bench;
+	target_addr_t address;
+	unsigned int iterations;
+	uint32_t size;
+
+	if (CMD_ARGC < 2 || CMD_ARGC > 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+	int retval = CALL_COMMAND_HANDLER(benchmark_parse_iterations, 2, &iterations);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint8_t *buffer = malloc(size);
+	if (!buffer) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+	for (uint32_t i = 0; i < size; i++)
+		buffer[i] = i * 97 + 13;
+
+	benchmark_start(&bench, "write");
+	for (unsigned int i = 0; i < iterations && retval == ERROR_OK; i++) {
+		retval = target_write_buffer(target, address, size, buffer);
+		bench.bytes += size;
+		bench.iterations++;
+	}
+	free(buffer);
+
+	if (retval != ERROR_OK)
+		return retval;
+	return benchmark_report(CMD, &bench);
+}
+
+/* Read every general register from the target one by one, the way GDB
+ * does for registers that are not part of its 'g' packet cache. */
+COMMAND_HANDLER(handle_benchmark_regs_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct benchmark bench;
+	struct reg **reg_list;
+	int reg_list_size;
+	unsigned int iterations;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	int retval = CALL_COMMAND_HANDLER(benchmark_parse_iterations, 0, &iterations);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = benchmark_check_halted(CMD, target);
+	if (retval != ERROR_OK)
+		return retval;
+
+	retval = target_get_gdb_reg_list(target, &reg_list, &reg_list_size, REG_CLASS_GENERAL);
+	if (retval != ERROR_OK)
+		return retval;
+
+	benchmark_start(&bench, "regs");
+	for (unsigned int i = 0; i < iterations && retval == ERROR_OK; i++) {
+		for (int j = 0; j < reg_list_size && retval == ERROR_OK; j++) {
+			struct reg *reg = reg_list[j];
+
+			/* never drop a value that still has to be written back */
+			if (!reg->exist || reg->dirty)
+				continue;
+			reg->valid = false;
+			retval = reg->type->get(reg);
+			bench.bytes += DIV_ROUND_UP(reg->size, 8);
+		}
+		bench.iterations++;
+	}
+	free(reg_list);
+
+	if (retval != ERROR_OK)
+		return retval;
+	return benchmark_report(CMD, &bench);
+}
+
+COMMAND_HANDLER(handle_benchmark_step_command)
+{
+	struct target *target = get_current_target(CMD_CTX);
+	struct benchmark bench;
+	unsigned int iterations;
+
+	if (CMD_ARGC > 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	int retval = CALL_COMMAND_HANDLER(benchmark_parse_iterations, 0, &iterations);
+	if (retval != ERROR_OK)
+		return retval;
+
+	benchmark_start(&bench, "step");
+	for (unsigned int i = 0; i < iterations && retval == ERROR_OK; i++) {
+		retval = benchmark_check_halted(CMD, target);
+		if (retval == ERROR_OK)
+			retval = target_step(target, 1, 0, 0);
+		bench.iterations++;
+	}
+
+	if (retval != ERROR_OK)
+		return retval;
+	return benchmark_report(CMD, &bench);
+}
+
+/* Time an arbitrary script, e.g. "flash write_image" or "verify_image",
+ * with the number of bytes it moves given by the caller. */
+COMMAND_HANDLER(handle_benchmark_eval_command)
+{
+	struct benchmark bench;
+	uint64_t bytes;
+
+	if (CMD_ARGC != 3)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (strpbrk(CMD_ARGV[0], "\"\\")) {
+		command_print(CMD, "benchmark name must not contain quotes or backslashes");
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+	}
+	COMMAND_PARSE_NUMBER(u64, CMD_ARGV[1], bytes);
+
+	benchmark_start(&bench, CMD_ARGV[0]);
+	int retval = Jim_Eval(CMD_CTX->interp, CMD_ARGV[2]);
+	if (retval != JIM_OK) {
+		command_print(CMD, "%s", Jim_GetString(Jim_GetResult(CMD_CTX->interp), NULL));
+		return ERROR_FAIL;
+	}
+	bench.bytes = bytes;
+	bench.iterations = 1;
+
+	return benchmark_report(CMD, &bench);
+}
+
+static const struct command_registration benchmark_subcommand_handlers[] = {
+	{
+		.name = "read",
+		.handler = handle_benchmark_read_command,
+		.mode = COMMAND_EXEC,
+		.help = "time reading target memory with target_read_buffer()",
+		.usage = "address size [iterations]",
+	},
+	{
+		.name = "write",
+		.handler = handle_benchmark_write_command,
+		.mode = COMMAND_EXEC,
+		.help = "time writing a test pattern to target memory with target_write_buffer()",
+		.usage = "address size [iterations]",
+	},
+	{
+		.name = "regs",
+		.handler = handle_benchmark_regs_command,
+		.mode = COMMAND_EXEC,
+		.help = "time reading all general registers from the halted target",
+		.usage = "[iterations]",
+	},
+	{
+		.name = "step",
+		.handler = handle_benchmark_step_command,
+		.mode = COMMAND_EXEC,
+		.help = "time single-stepping the halted target",
+		.usage = "[iterations]",
+	},
+	{
+		.name = "eval",
+		.handler = handle_benchmark_eval_command,
+		.mode = COMMAND_EXEC,
+		.help = "time a script that moves the given number of bytes",
+		.usage = "name bytes script",
+	},
+	COMMAND_REGISTRATION_DONE
+};
+
+const struct command_registration benchmark_command_handlers[] = {
+	{
+		.name = "benchmark",
+		.mode = COMMAND_ANY,
+		.help = "measure throughput and adapter round trips",
+		.chain = benchmark_subcommand_handlers,
+		.usage = "",
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -56,6 +56,9 @@
 /* Timeout for register r/w */
 #define DHCSR_S_REGRDY_TIMEOUT (500)
 
+/* DWT_PCSR reads queued per adapter transaction while profiling */
+#define CORTEX_M_PCSR_BATCH (1024)
+
 /* Supported Cortex-M Cores */
 static const struct cortex_m_part_info cortex_m_parts[] = {
 	{
@@ -2032,15 +2035,30 @@ int cortex_m_profiling(struct target *target, uint32_t *samples,
 	for (;;) {
 		if (armv7m && armv7m->debug_ap) {
 			uint32_t read_count = max_num_samples - sample_count;
-			if (read_count > 1024)
-				read_count = 1024;
+			if (read_count > CORTEX_M_PCSR_BATCH)
+				read_count = CORTEX_M_PCSR_BATCH;
 
+			/* one queued transaction of non-incrementing PCSR reads */
 			retval = mem_ap_read_buf_noincr(armv7m->debug_ap,
 						(void *)&samples[sample_count],
 						4, read_count, DWT_PCSR);
-			sample_count += read_count;
+
+			/* PCSR reads as all ones while the core is halted or sleeping;
+			 * such samples carry no PC and would break the histogram range */
+			if (retval == ERROR_OK) {
+				uint32_t base = sample_count;
+				for (uint32_t i = 0; i < read_count; i++) {
+					uint32_t pc = target_buffer_get_u32(target,
+							(uint8_t *)&samples[base + i]);
+					if (pc != 0xffffffff)
+						samples[sample_count++] = pc;
+				}
+			}
 		} else {
-			target_read_u32(target, DWT_PCSR, &samples[sample_count++]);
+			uint32_t pc;
+			retval = target_read_u32(target, DWT_PCSR, &pc);
+			if (retval == ERROR_OK && pc != 0xffffffff)
+				samples[sample_count++] = pc;
 		}
 
 		if (retval != ERROR_OK) {
@@ -122,6 +122,146 @@ static int identify_image_type(struct image *image, const char *type_string, con
 	return ERROR_OK;
 }
 
+/* Remember where decoding can start over to get the data byte at
+ * @a data_offset, unless a mark close enough before it exists already */
+static int image_text_add_mark(struct image_text_index *index,
+		size_t file_offset, uint32_t data_offset)
+{
+	if (index->num_marks && data_offset - index->marks[index->num_marks - 1].data_offset
+			< IMAGE_TEXT_MARK_INTERVAL)
+		return ERROR_OK;
+
+	struct image_text_mark *marks = realloc(index->marks,
+			(index->num_marks + 1) * sizeof(*marks));
+	if (!marks) {
+		LOG_ERROR("Out of memory");
+		return ERROR_FAIL;
+	}
+
+	marks[index->num_marks].file_offset = file_offset;
+	marks[index->num_marks].data_offset = data_offset;
+	index->marks = marks;
+	index->num_marks++;
+	return ERROR_OK;
+}
+
+static void image_text_free(struct image_text_index *index)
+{
+	free(index->line);
+	index->line = NULL;
+	free(index->marks);
+	index->marks = NULL;
+	index->num_marks = 0;
+	index->next_valid = false;
+}
+
+/* Data bytes of a record, none for anything but a data record */
+typedef int (*image_text_record_data_t)(const char *line, uint8_t *data, uint32_t *count);
+
+/**
+ * Decode @a size bytes at @a offset of @a section of an IHEX or S-record
+ * image. The sections hold the data bytes of the file in file order, so
+ * decoding starts at the last mark before those bytes, or where the
+ * previous read left off, and collects the data records from there on.
+ * Sequential reads thus decode every record only once.
+ */
+static int image_text_read_section(struct image *image, struct fileio *fileio,
+		struct image_text_index *index, image_text_record_data_t record_data,
+		int section, uint32_t offset, uint32_t size, uint8_t *buffer)
+{
+	uint8_t data[255];
+	uint32_t start = offset;
+	int retval;
+
+	for (int i = 0; i < section; i++)
+		start += image->sections[i].size;
+	uint32_t end = start + size;
+
+	if (!size)
+		return ERROR_OK;
+	if (!index->num_marks)
+		return ERROR_IMAGE_FORMAT_ERROR;
+
+	/* the first mark is at the first data byte */
+	unsigned int low = 0, high = index->num_marks;
+	while (high - low > 1) {
+		unsigned int middle = (low + high) / 2;
+		if (index->marks[middle].data_offset <= start)
+			low = middle;
+		else
+			high = middle;
+	}
+	struct image_text_mark mark = index->marks[low];
+	if (index->next_valid && index->next.data_offset <= start
+			&& index->next.data_offset >= mark.data_offset)
+		mark = index->next;
+
+	retval = fileio_seek(fileio, mark.file_offset);
+	if (retval != ERROR_OK)
+		return retval;
+
+	uint32_t data_offset = mark.data_offset;
+	while (data_offset < end) {
+		size_t line_offset;
+		uint32_t count;
+
+		retval = fileio_tell(fileio, &line_offset);
+		if (retval != ERROR_OK)
+			return retval;
+		if (fileio_fgets(fileio, 1023, index->line) != ERROR_OK) {
+			LOG_ERROR("image file ended in the middle of section %d, was it changed?", section);
+			return ERROR_IMAGE_FORMAT_ERROR;
+		}
+
+		/* skip comments and blank lines */
+		if ((index->line[0] == '#') || (strlen(index->line + strspn(index->line, "\n\t\r ")) == 0))
+			continue;
+
+		retval = record_data(index->line, data, &count);
+		if (retval != ERROR_OK)
+			return retval;
+
+		if (data_offset + count > start) {
+			uint32_t from = (data_offset > start) ? data_offset : start;
+			uint32_t to = (data_offset + count < end) ? data_offset + count : end;
+			memcpy(buffer + (from - start), data + (from - data_offset), to - from);
+		}
+
+		/* the next read may start in this very record */
+		index->next.file_offset = line_offset;
+		index->next.data_offset = data_offset;
+		index->next_valid = true;
+
+		data_offset += count;
+	}
+
+	return ERROR_OK;
+}
+
+static int image_ihex_record_data(const char *line, uint8_t *data, uint32_t *count)
+{
+	uint32_t address;
+	uint32_t record_type;
+
+	if (sscanf(line, ":%2" SCNx32 "%4" SCNx32 "%2" SCNx32, count, &address, &record_type) != 3)
+		return ERROR_IMAGE_FORMAT_ERROR;
+
+	if (record_type != 0) {
+		*count = 0;
+		return ERROR_OK;
+	}
+
+	for (uint32_t i = 0; i < *count; i++) {
+		unsigned int value;
+
+		if (sscanf(&line[9 + 2 * i], "%2x", &value) != 1)
+			return ERROR_IMAGE_FORMAT_ERROR;
+		data[i] = value;
+	}
+
+	return ERROR_OK;
+}
+
 static int image_ihex_buffer_complete_inner(struct image *image,
 	char *lpsz_line,
 	struct imagesection *section)
@@ -132,27 +272,24 @@ static int image_ihex_buffer_complete_inner(struct image *image,
 	uint32_t cooked_bytes;
 	bool end_rec = false;
 
+	size_t line_offset;
+	int retval;
+
 	/* we can't determine the number of sections that we'll have to create ahead of time,
 	 * so we locally hold them until parsing is finished */
 
-	size_t filesize;
-	int retval;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
-
-	ihex->buffer = malloc(filesize >> 1);
 	cooked_bytes = 0x0;
 	image->num_sections = 0;
 
 	while (!fileio_feof(fileio)) {
 		full_address = 0x0;
-		section[image->num_sections].private = &ihex->buffer[cooked_bytes];
+		section[image->num_sections].private = NULL;
 		section[image->num_sections].base_address = 0x0;
 		section[image->num_sections].size = 0x0;
 		section[image->num_sections].flags = 0;
 
-		while (fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
+		while (fileio_tell(fileio, &line_offset) == ERROR_OK
+				&& fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
 			uint32_t count;
 			uint32_t address;
 			uint32_t record_type;
@@ -189,19 +326,23 @@ static int image_ihex_buffer_complete_inner(struct image *image,
 						}
 						section[image->num_sections].size = 0x0;
 						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
+						section[image->num_sections].private = NULL;
 					}
 					section[image->num_sections].base_address =
 						(full_address & 0xffff0000) | address;
 					full_address = (full_address & 0xffff0000) | address;
 				}
 
+				if (count > 0) {
+					retval = image_text_add_mark(&ihex->index, line_offset, cooked_bytes);
+					if (retval != ERROR_OK)
+						return retval;
+				}
+
 				while (count-- > 0) {
 					unsigned value;
 					sscanf(&lpsz_line[bytes_read], "%2x", &value);
-					ihex->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)ihex->buffer[cooked_bytes];
+					cal_checksum += (uint8_t)value;
 					bytes_read += 2;
 					cooked_bytes += 1;
 					section[image->num_sections].size += 1;
@@ -244,8 +385,7 @@ static int image_ihex_buffer_complete_inner(struct image *image,
 						}
 						section[image->num_sections].size = 0x0;
 						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
+						section[image->num_sections].private = NULL;
 					}
 					section[image->num_sections].base_address =
 						(full_address & 0xffff) | (upper_address << 4);
@@ -283,8 +423,7 @@ static int image_ihex_buffer_complete_inner(struct image *image,
 						}
 						section[image->num_sections].size = 0x0;
 						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&ihex->buffer[cooked_bytes];
+						section[image->num_sections].private = NULL;
 					}
 					section[image->num_sections].base_address =
 						(full_address & 0xffff) | (upper_address << 16);
@@ -336,6 +475,7 @@ static int image_ihex_buffer_complete_inner(struct image *image,
  */
 static int image_ihex_buffer_complete(struct image *image)
 {
+	struct image_ihex *ihex = image->type_private;
 	char *lpsz_line = malloc(1023);
 	if (!lpsz_line) {
 		LOG_ERROR("Out of memory");
@@ -352,7 +492,11 @@ static int image_ihex_buffer_complete(struct image *image)
 	retval = image_ihex_buffer_complete_inner(image, lpsz_line, section);
 
 	free(section);
-	free(lpsz_line);
+
+	/* the line buffer is used again to decode the sections */
+	ihex->index.line = lpsz_line;
+	if (retval != ERROR_OK)
+		image_text_free(&ihex->index);
 
 	return retval;
 }
@@ -676,6 +820,11 @@ static int image_elf32_read_section(struct image *image,
 		LOG_DEBUG("read elf: size = 0x%zx at 0x%" TARGET_PRIxADDR "", read_size,
 			field32(elf, segment->p_offset) + offset);
 		/* read initialized area of the segment */
+		if (elf->mapped && field32(elf, segment->p_offset) + offset + read_size <= elf->mapped_size) {
+			memcpy(buffer, elf->mapped + field32(elf, segment->p_offset) + offset, read_size);
+			*size_read += read_size;
+			return ERROR_OK;
+		}
 		retval = fileio_seek(elf->fileio, field32(elf, segment->p_offset) + offset);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("cannot find ELF segment content, seek failed");
@@ -719,6 +868,11 @@ static int image_elf64_read_section(struct image *image,
 		LOG_DEBUG("read elf: size = 0x%zx at 0x%" TARGET_PRIxADDR "", read_size,
 			field64(elf, segment->p_offset) + offset);
 		/* read initialized area of the segment */
+		if (elf->mapped && field64(elf, segment->p_offset) + offset + read_size <= elf->mapped_size) {
+			memcpy(buffer, elf->mapped + field64(elf, segment->p_offset) + offset, read_size);
+			*size_read += read_size;
+			return ERROR_OK;
+		}
 		retval = fileio_seek(elf->fileio, field64(elf, segment->p_offset) + offset);
 		if (retval != ERROR_OK) {
 			LOG_ERROR("cannot find ELF segment content, seek failed");
@@ -754,6 +908,36 @@ static int image_elf_read_section(struct image *image,
 		return image_elf32_read_section(image, section, offset, size, buffer, size_read);
 }
 
+static int image_mot_record_data(const char *line, uint8_t *data, uint32_t *count)
+{
+	uint32_t record_type;
+
+	if (sscanf(line, "S%1" SCNx32 "%2" SCNx32, &record_type, count) != 2)
+		return ERROR_IMAGE_FORMAT_ERROR;
+
+	if (record_type < 1 || record_type > 3) {
+		*count = 0;
+		return ERROR_OK;
+	}
+
+	/* S1, S2 and S3 have 16, 24 and 32 bit addresses ahead of the data,
+	 * and the count includes those and the checksum */
+	uint32_t address_bytes = record_type + 1;
+	if (*count < address_bytes + 1)
+		return ERROR_IMAGE_FORMAT_ERROR;
+	*count -= address_bytes + 1;
+
+	for (uint32_t i = 0; i < *count; i++) {
+		unsigned int value;
+
+		if (sscanf(&line[4 + 2 * (address_bytes + i)], "%2x", &value) != 1)
+			return ERROR_IMAGE_FORMAT_ERROR;
+		data[i] = value;
+	}
+
+	return ERROR_OK;
+}
+
 static int image_mot_buffer_complete_inner(struct image *image,
 	char *lpsz_line,
 	struct imagesection *section)
@@ -764,27 +948,24 @@ static int image_mot_buffer_complete_inner(struct image *image,
 	uint32_t cooked_bytes;
 	bool end_rec = false;
 
+	size_t line_offset;
+	int retval;
+
 	/* we can't determine the number of sections that we'll have to create ahead of time,
 	 * so we locally hold them until parsing is finished */
 
-	int retval;
-	size_t filesize;
-	retval = fileio_size(fileio, &filesize);
-	if (retval != ERROR_OK)
-		return retval;
-
-	mot->buffer = malloc(filesize >> 1);
 	cooked_bytes = 0x0;
 	image->num_sections = 0;
 
 	while (!fileio_feof(fileio)) {
 		full_address = 0x0;
-		section[image->num_sections].private = &mot->buffer[cooked_bytes];
+		section[image->num_sections].private = NULL;
 		section[image->num_sections].base_address = 0x0;
 		section[image->num_sections].size = 0x0;
 		section[image->num_sections].flags = 0;
 
-		while (fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
+		while (fileio_tell(fileio, &line_offset) == ERROR_OK
+				&& fileio_fgets(fileio, 1023, lpsz_line) == ERROR_OK) {
 			uint32_t count;
 			uint32_t address;
 			uint32_t record_type;
@@ -859,18 +1040,22 @@ static int image_mot_buffer_complete_inner(struct image *image,
 						image->num_sections++;
 						section[image->num_sections].size = 0x0;
 						section[image->num_sections].flags = 0;
-						section[image->num_sections].private =
-							&mot->buffer[cooked_bytes];
+						section[image->num_sections].private = NULL;
 					}
 					section[image->num_sections].base_address = address;
 					full_address = address;
 				}
 
+				if (count > 0) {
+					retval = image_text_add_mark(&mot->index, line_offset, cooked_bytes);
+					if (retval != ERROR_OK)
+						return retval;
+				}
+
 				while (count-- > 0) {
 					unsigned value;
 					sscanf(&lpsz_line[bytes_read], "%2x", &value);
-					mot->buffer[cooked_bytes] = (uint8_t)value;
-					cal_checksum += (uint8_t)mot->buffer[cooked_bytes];
+					cal_checksum += (uint8_t)value;
 					bytes_read += 2;
 					cooked_bytes += 1;
 					section[image->num_sections].size += 1;
@@ -936,6 +1121,7 @@ static int image_mot_buffer_complete_inner(struct image *image,
  */
 static int image_mot_buffer_complete(struct image *image)
 {
+	struct image_mot *mot = image->type_private;
 	char *lpsz_line = malloc(1023);
 	if (!lpsz_line) {
 		LOG_ERROR("Out of memory");
@@ -952,7 +1138,11 @@ static int image_mot_buffer_complete(struct image *image)
 	retval = image_mot_buffer_complete_inner(image, lpsz_line, section);
 
 	free(section);
-	free(lpsz_line);
+
+	/* the line buffer is used again to decode the sections */
+	mot->index.line = lpsz_line;
+	if (retval != ERROR_OK)
+		image_text_free(&mot->index);
 
 	return retval;
 }
@@ -973,6 +1163,8 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		retval = fileio_open(&image_binary->fileio, url, FILEIO_READ, FILEIO_BINARY);
 		if (retval != ERROR_OK)
 			return retval;
+		if (fileio_mmap(image_binary->fileio, &image_binary->mapped) != ERROR_OK)
+			image_binary->mapped = NULL;
 		size_t filesize;
 		retval = fileio_size(image_binary->fileio, &filesize);
 		if (retval != ERROR_OK) {
@@ -989,6 +1181,7 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		struct image_ihex *image_ihex;
 
 		image_ihex = image->type_private = malloc(sizeof(struct image_ihex));
+		memset(&image_ihex->index, 0, sizeof(image_ihex->index));
 
 		retval = fileio_open(&image_ihex->fileio, url, FILEIO_READ, FILEIO_TEXT);
 		if (retval != ERROR_OK)
@@ -1009,6 +1202,9 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		retval = fileio_open(&image_elf->fileio, url, FILEIO_READ, FILEIO_BINARY);
 		if (retval != ERROR_OK)
 			return retval;
+		if (fileio_mmap(image_elf->fileio, &image_elf->mapped) != ERROR_OK
+				|| fileio_size(image_elf->fileio, &image_elf->mapped_size) != ERROR_OK)
+			image_elf->mapped = NULL;
 
 		retval = image_elf_read_headers(image);
 		if (retval != ERROR_OK) {
@@ -1040,6 +1236,7 @@ int image_open(struct image *image, const char *url, const char *type_string)
 		struct image_mot *image_mot;
 
 		image_mot = image->type_private = malloc(sizeof(struct image_mot));
+		memset(&image_mot->index, 0, sizeof(image_mot->index));
 
 		retval = fileio_open(&image_mot->fileio, url, FILEIO_READ, FILEIO_TEXT);
 		if (retval != ERROR_OK)
@@ -1099,6 +1296,12 @@ int image_read_section(struct image *image,
 		if (section != 0)
 			return ERROR_COMMAND_SYNTAX_ERROR;
 
+		if (image_binary->mapped) {
+			memcpy(buffer, image_binary->mapped + offset, size);
+			*size_read = size;
+			return ERROR_OK;
+		}
+
 		/* seek to offset */
 		retval = fileio_seek(image_binary->fileio, offset);
 		if (retval != ERROR_OK)
@@ -1109,7 +1312,12 @@ int image_read_section(struct image *image,
 		if (retval != ERROR_OK)
 			return retval;
 	} else if (image->type == IMAGE_IHEX) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
+		struct image_ihex *image_ihex = image->type_private;
+
+		retval = image_text_read_section(image, image_ihex->fileio, &image_ihex->index,
+				image_ihex_record_data, section, offset, size, buffer);
+		if (retval != ERROR_OK)
+			return retval;
 		*size_read = size;
 
 		return ERROR_OK;
@@ -1154,7 +1362,12 @@ int image_read_section(struct image *image,
 			address += (size_in_cache > size) ? size : size_in_cache;
 		}
 	} else if (image->type == IMAGE_SRECORD) {
-		memcpy(buffer, (uint8_t *)image->sections[section].private + offset, size);
+		struct image_mot *image_mot = image->type_private;
+
+		retval = image_text_read_section(image, image_mot->fileio, &image_mot->index,
+				image_mot_record_data, section, offset, size, buffer);
+		if (retval != ERROR_OK)
+			return retval;
 		*size_read = size;
 
 		return ERROR_OK;
@@ -1168,6 +1381,59 @@ int image_read_section(struct image *image,
 	return ERROR_OK;
 }
 
+/**
+ * Get a pointer to section data that is already held in memory, either
+ * because the image was built there or because the file is mapped (binary,
+ * ELF). This lets callers use the data in place instead of copying it with
+ * image_read_section(). IHEX and S-record data is never resident, it is
+ * decoded on every read.
+ *
+ * @returns ERROR_IMAGE_TEMPORARILY_UNAVAILABLE if the requested range is
+ * not resident; image_read_section() must be used instead.
+ */
+int image_section_data(struct image *image, int section, target_addr_t offset,
+		uint32_t size, const uint8_t **data)
+{
+	if (offset + size > image->sections[section].size)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	if (image->type == IMAGE_BUILDER) {
+		*data = (const uint8_t *)image->sections[section].private + offset;
+		return ERROR_OK;
+	} else if (image->type == IMAGE_BINARY) {
+		struct image_binary *image_binary = image->type_private;
+
+		if (image_binary->mapped && section == 0) {
+			*data = image_binary->mapped + offset;
+			return ERROR_OK;
+		}
+	} else if (image->type == IMAGE_ELF) {
+		struct image_elf *elf = image->type_private;
+		uint64_t file_offset, file_size;
+
+		if (!elf->mapped)
+			return ERROR_IMAGE_TEMPORARILY_UNAVAILABLE;
+
+		if (elf->is_64_bit) {
+			Elf64_Phdr *segment = image->sections[section].private;
+			file_offset = field64(elf, segment->p_offset);
+			file_size = field64(elf, segment->p_filesz);
+		} else {
+			Elf32_Phdr *segment = image->sections[section].private;
+			file_offset = field32(elf, segment->p_offset);
+			file_size = field32(elf, segment->p_filesz);
+		}
+
+		/* uninitialized (bss-like) parts of a segment aren't in the file */
+		if (offset + size <= file_size && file_offset + offset + size <= elf->mapped_size) {
+			*data = elf->mapped + file_offset + offset;
+			return ERROR_OK;
+		}
+	}
+
+	return ERROR_IMAGE_TEMPORARILY_UNAVAILABLE;
+}
+
 int image_add_section(struct image *image, target_addr_t base, uint32_t size, int flags, uint8_t const *data)
 {
 	struct imagesection *section;
@@ -1216,8 +1482,7 @@ void image_close(struct image *image)
 
 		fileio_close(image_ihex->fileio);
 
-		free(image_ihex->buffer);
-		image_ihex->buffer = NULL;
+		image_text_free(&image_ihex->index);
 	} else if (image->type == IMAGE_ELF) {
 		struct image_elf *image_elf = image->type_private;
 
@@ -1246,8 +1511,7 @@ void image_close(struct image *image)
 
 		fileio_close(image_mot->fileio);
 
-		free(image_mot->buffer);
-		image_mot->buffer = NULL;
+		image_text_free(&image_mot->index);
 	} else if (image->type == IMAGE_BUILDER) {
 		for (unsigned int i = 0; i < image->num_sections; i++) {
 			free(image->sections[i].private);
@@ -1262,35 +1526,61 @@ void image_close(struct image *image)
 	image->sections = NULL;
 }
 
+/* The CRC is the non-reflected CRC-32 gdb uses for qCRC. It is computed
+ * eight bytes at a time ("slice-by-8"): crc32_table[k][i] is the CRC
+ * contribution of byte value i followed by k zero bytes. */
+static uint32_t crc32_table[8][256];
+
+static void image_crc32_init(void)
+{
+	static bool first_init;
+	if (first_init)
+		return;
+
+	for (unsigned int i = 0; i < 256; i++) {
+		uint32_t c = i << 24;
+		/* as per gdb */
+		for (unsigned int j = 8; j > 0; --j)
+			c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
+		crc32_table[0][i] = c;
+	}
+	for (unsigned int k = 1; k < 8; k++) {
+		for (unsigned int i = 0; i < 256; i++) {
+			uint32_t c = crc32_table[k - 1][i];
+			crc32_table[k][i] = (c << 8) ^ crc32_table[0][c >> 24];
+		}
+	}
+
+	first_init = true;
+}
+
 int image_calculate_checksum(const uint8_t *buffer, uint32_t nbytes, uint32_t *checksum)
 {
 	uint32_t crc = 0xffffffff;
 	LOG_DEBUG("Calculating checksum");
 
-	static uint32_t crc32_table[256];
-
-	static bool first_init;
-	if (!first_init) {
-		/* Initialize the CRC table and the decoding table.  */
-		unsigned int i, j, c;
-		for (i = 0; i < 256; i++) {
-			/* as per gdb */
-			for (c = i << 24, j = 8; j > 0; --j)
-				c = c & 0x80000000 ? (c << 1) ^ 0x04c11db7 : (c << 1);
-			crc32_table[i] = c;
-		}
-
-		first_init = true;
-	}
+	image_crc32_init();
 
 	while (nbytes > 0) {
-		int run = nbytes;
-		if (run > 32768)
-			run = 32768;
+		uint32_t run = nbytes;
+		if (run > 1024 * 1024)
+			run = 1024 * 1024;
 		nbytes -= run;
+
+		for (; run >= 8; run -= 8, buffer += 8) {
+			uint32_t one = crc ^ be_to_h_u32(buffer);
+			crc = crc32_table[7][one >> 24] ^
+				crc32_table[6][(one >> 16) & 0xff] ^
+				crc32_table[5][(one >> 8) & 0xff] ^
+				crc32_table[4][one & 0xff] ^
+				crc32_table[3][buffer[4]] ^
+				crc32_table[2][buffer[5]] ^
+				crc32_table[1][buffer[6]] ^
+				crc32_table[0][buffer[7]];
+		}
 		while (run--) {
 			/* as per gdb */
-			crc = (crc << 8) ^ crc32_table[((crc >> 24) ^ *buffer++) & 255];
+			crc = (crc << 8) ^ crc32_table[0][((crc >> 24) ^ *buffer++) & 255];
 		}
 		keep_alive();
 	}
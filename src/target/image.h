@@ -40,6 +40,8 @@
 
 #define IMAGE_MEMORY_CACHE_SIZE		(2048)
 
+#define IMAGE_TEXT_MARK_INTERVAL	(4096)
+
 enum image_type {
 	IMAGE_BINARY,	/* plain binary */
 	IMAGE_IHEX,		/* intel hex-record format */
@@ -69,11 +71,29 @@ struct image {
 
 struct image_binary {
 	struct fileio *fileio;
+	const uint8_t *mapped;	/* whole file contents if mapped, else NULL */
+};
+
+/* A line of an IHEX or S-record file, and the number of data bytes that
+ * the records before it hold */
+struct image_text_mark {
+	size_t file_offset;
+	uint32_t data_offset;
+};
+
+/* IHEX and S-record files are only indexed when opened, the data is decoded
+ * again whenever a section is read */
+struct image_text_index {
+	char *line;
+	struct image_text_mark *marks;	/* one every IMAGE_TEXT_MARK_INTERVAL data bytes */
+	unsigned int num_marks;
+	struct image_text_mark next;	/* where the last read left off */
+	bool next_valid;
 };
 
 struct image_ihex {
 	struct fileio *fileio;
-	uint8_t *buffer;
+	struct image_text_index index;
 };
 
 struct image_memory {
@@ -95,16 +115,20 @@ struct image_elf {
 	};
 	uint32_t segment_count;
 	uint8_t endianness;
+	const uint8_t *mapped;	/* whole file contents if mapped, else NULL */
+	size_t mapped_size;
 };
 
 struct image_mot {
 	struct fileio *fileio;
-	uint8_t *buffer;
+	struct image_text_index index;
 };
 
 int image_open(struct image *image, const char *url, const char *type_string);
 int image_read_section(struct image *image, int section, target_addr_t offset,
 		uint32_t size, uint8_t *buffer, size_t *size_read);
+int image_section_data(struct image *image, int section, target_addr_t offset,
+		uint32_t size, const uint8_t **data);
 void image_close(struct image *image);
 
 int image_add_section(struct image *image, target_addr_t base, uint32_t size,
@@ -0,0 +1,283 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <helper/align.h>
+#include <helper/log.h>
+
+#include "target.h"
+#include "armv7m.h"
+#include "memory_cache.h"
+
+/*
+ * Memory read cache shared by all clients of a target.
+ *
+ * While the target is halted, the reads of all GDB connections to it are
+ * served from one set of 64 byte lines per target, so the stack frames and
+ * variables every client looks at after a stop are fetched from the target
+ * only once. The cache is dropped whenever target_memory_changed() is
+ * called. Scripts always read the target, so they can see memory that
+ * changed behind the debugger's back, e.g. through DMA.
+ *
+ * Peripherals must never be cached. On Cortex-M targets the device and
+ * system regions of the architectural memory map are excluded by default.
+ * Other architectures have no such fixed map, so their memory is only
+ * cached once the user has declared the volatile regions.
+ */
+
+#define MEMORY_CACHE_LINE_SIZE	64
+#define MEMORY_CACHE_LINES		256
+/* number of lines fetched at once on sequential reads */
+#define MEMORY_CACHE_PREFETCH	8
+#define MEMORY_CACHE_MAX_VOLATILE	16
+
+struct memory_cache_line {
+	bool valid;
+	target_addr_t address;
+	uint8_t data[MEMORY_CACHE_LINE_SIZE];
+};
+
+struct target_memory_cache {
+	unsigned int epoch;
+	/* line following the last fill, to detect sequential reads */
+	target_addr_t next_line;
+	struct memory_cache_line lines[MEMORY_CACHE_LINES];
+};
+
+/* memory that must always be read from the target, e.g. peripherals */
+struct volatile_region {
+	target_addr_t start;
+	target_addr_t last;
+};
+
+static int use_memory_cache = 1;
+
+/* the device and system regions of the Cortex-M memory map */
+static const struct volatile_region cortex_m_volatile_regions[] = {
+	{ 0x40000000, 0x5fffffff },
+	{ 0xa0000000, 0xffffffff },
+};
+
+/* regions declared with memory_cache_volatile */
+static struct volatile_region volatile_regions[MEMORY_CACHE_MAX_VOLATILE];
+static unsigned int num_volatile_regions;
+
+static bool volatile_overlap(const struct volatile_region *regions, unsigned int num_regions,
+		target_addr_t address, target_addr_t last)
+{
+	for (unsigned int i = 0; i < num_regions; i++) {
+		if (address <= regions[i].last && last >= regions[i].start)
+			return true;
+	}
+	return false;
+}
+
+static bool memory_cacheable(struct target *target, target_addr_t address, uint32_t size)
+{
+	target_addr_t last = address + size - 1;
+
+	if (last < address)
+		return false;
+
+	if (volatile_overlap(volatile_regions, num_volatile_regions, address, last))
+		return false;
+
+	if (target_to_armv7m_safe(target))
+		return !volatile_overlap(cortex_m_volatile_regions,
+				ARRAY_SIZE(cortex_m_volatile_regions), address, last);
+
+	/* unknown memory map: everything is volatile unless the user said otherwise */
+	return num_volatile_regions > 0;
+}
+
+static int memory_cache_fill(struct target *target, struct target_memory_cache *cache,
+		target_addr_t address, unsigned int num_lines)
+{
+	uint8_t buffer[MEMORY_CACHE_PREFETCH * MEMORY_CACHE_LINE_SIZE];
+
+	int retval = target_read_buffer(target, address,
+			num_lines * MEMORY_CACHE_LINE_SIZE, buffer);
+	if (retval != ERROR_OK)
+		return retval;
+
+	for (unsigned int i = 0; i < num_lines; i++) {
+		target_addr_t line_address = address + i * MEMORY_CACHE_LINE_SIZE;
+		struct memory_cache_line *line = &cache->lines[
+			(line_address / MEMORY_CACHE_LINE_SIZE) % MEMORY_CACHE_LINES];
+
+		line->valid = true;
+		line->address = line_address;
+		memcpy(line->data, buffer + i * MEMORY_CACHE_LINE_SIZE, MEMORY_CACHE_LINE_SIZE);
+	}
+
+	cache->next_line = address + num_lines * MEMORY_CACHE_LINE_SIZE;
+	return ERROR_OK;
+}
+
+/**
+ * Tells whether a read of @a size bytes at @a address would be served by
+ * the cache: only while the target is halted, outside volatile regions and
+ * for requests up to half the size of the cache.
+ */
+bool target_memory_cacheable(struct target *target, target_addr_t address, uint32_t size)
+{
+	target_addr_t first_line = address & ~(target_addr_t)(MEMORY_CACHE_LINE_SIZE - 1);
+	target_addr_t end = address + size;
+
+	return use_memory_cache && target->state == TARGET_HALTED
+		&& end - first_line <= MEMORY_CACHE_LINES * MEMORY_CACHE_LINE_SIZE / 2
+		&& memory_cacheable(target, first_line, ALIGN_UP(end, MEMORY_CACHE_LINE_SIZE) - first_line);
+}
+
+/**
+ * Tells whether @a size bytes at @a address may have side effects on read,
+ * or aren't known not to: the same regions the cache stays away from.
+ */
+bool target_memory_volatile(struct target *target, target_addr_t address, uint32_t size)
+{
+	return !memory_cacheable(target, address, size);
+}
+
+/**
+ * Read target memory through the cache of @a target, like
+ * target_read_buffer(). Reads that are not cacheable go straight to the
+ * target, see target_memory_cacheable(). Any error falls back to a plain
+ * read so data aborts are reported as before.
+ */
+int target_read_memory_cached(struct target *target,
+		target_addr_t address, uint32_t size, uint8_t *buffer)
+{
+	struct target_memory_cache *cache = target->memory_cache;
+	target_addr_t first_line = address & ~(target_addr_t)(MEMORY_CACHE_LINE_SIZE - 1);
+	target_addr_t end = address + size;
+
+	if (!target_memory_cacheable(target, address, size))
+		return target_read_buffer(target, address, size, buffer);
+
+	if (!cache) {
+		cache = calloc(1, sizeof(*cache));
+		if (!cache)
+			return target_read_buffer(target, address, size, buffer);
+		cache->epoch = target->memory_epoch;
+		target->memory_cache = cache;
+	}
+
+	if (cache->epoch != target->memory_epoch) {
+		for (unsigned int i = 0; i < MEMORY_CACHE_LINES; i++)
+			cache->lines[i].valid = false;
+		cache->epoch = target->memory_epoch;
+	}
+
+	for (target_addr_t line_address = first_line; line_address < end;
+			line_address += MEMORY_CACHE_LINE_SIZE) {
+		struct memory_cache_line *line = &cache->lines[
+			(line_address / MEMORY_CACHE_LINE_SIZE) % MEMORY_CACHE_LINES];
+
+		if (!line->valid || line->address != line_address) {
+			unsigned int num_lines = 1;
+			int retval;
+
+			if (line_address == cache->next_line) {
+				num_lines = MEMORY_CACHE_PREFETCH;
+				while (num_lines > 1 && !memory_cacheable(target, line_address,
+						num_lines * MEMORY_CACHE_LINE_SIZE))
+					num_lines /= 2;
+			}
+
+			retval = memory_cache_fill(target, cache, line_address, num_lines);
+			if (retval != ERROR_OK && num_lines > 1)
+				retval = memory_cache_fill(target, cache, line_address, 1);
+			if (retval != ERROR_OK)
+				return target_read_buffer(target, address, size, buffer);
+		}
+
+		target_addr_t from = MAX(address, line_address);
+		target_addr_t to = MIN(end, line_address + MEMORY_CACHE_LINE_SIZE);
+		memcpy(buffer + (from - address), line->data + (from - line_address), to - from);
+	}
+
+	return ERROR_OK;
+}
+
+void target_free_memory_cache(struct target *target)
+{
+	free(target->memory_cache);
+	target->memory_cache = NULL;
+}
+
+COMMAND_HANDLER(handle_memory_cache_command)
+{
+	if (CMD_ARGC != 1)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	COMMAND_PARSE_ENABLE(CMD_ARGV[0], use_memory_cache);
+	return ERROR_OK;
+}
+
+COMMAND_HANDLER(handle_memory_cache_volatile_command)
+{
+	if (CMD_ARGC == 0) {
+		for (unsigned int i = 0; i < num_volatile_regions; i++)
+			command_print(CMD, TARGET_ADDR_FMT " - " TARGET_ADDR_FMT,
+				volatile_regions[i].start, volatile_regions[i].last);
+		for (unsigned int i = 0; i < ARRAY_SIZE(cortex_m_volatile_regions); i++)
+			command_print(CMD, TARGET_ADDR_FMT " - " TARGET_ADDR_FMT " (Cortex-M)",
+				cortex_m_volatile_regions[i].start, cortex_m_volatile_regions[i].last);
+		return ERROR_OK;
+	}
+
+	if (CMD_ARGC != 2)
+		return ERROR_COMMAND_SYNTAX_ERROR;
+
+	target_addr_t address;
+	uint32_t size;
+	COMMAND_PARSE_ADDRESS(CMD_ARGV[0], address);
+	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[1], size);
+	if (size == 0)
+		return ERROR_COMMAND_ARGUMENT_INVALID;
+
+	if (num_volatile_regions == MEMORY_CACHE_MAX_VOLATILE) {
+		command_print(CMD, "at most %d volatile regions are supported",
+			MEMORY_CACHE_MAX_VOLATILE);
+		return ERROR_FAIL;
+	}
+
+	volatile_regions[num_volatile_regions].start = address;
+	volatile_regions[num_volatile_regions].last = address + size - 1;
+	num_volatile_regions++;
+	return ERROR_OK;
+}
+
+const struct command_registration memory_cache_command_handlers[] = {
+	{
+		.name = "memory_cache",
+		.handler = handle_memory_cache_command,
+		.mode = COMMAND_ANY,
+		.help = "enable or disable caching memory reads while the target is halted",
+		.usage = "('enable'|'disable')"
+	},
+	{
+		.name = "memory_cache_volatile",
+		.handler = handle_memory_cache_volatile_command,
+		.mode = COMMAND_ANY,
+		.help = "exclude a memory region from the memory cache, "
+			"or list the excluded regions",
+		.usage = "[address size]"
+	},
+	COMMAND_REGISTRATION_DONE
+};
@@ -0,0 +1,32 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>. *
+ ***************************************************************************/
+
+#ifndef OPENOCD_TARGET_MEMORY_CACHE_H
+#define OPENOCD_TARGET_MEMORY_CACHE_H
+
+#include <helper/command.h>
+#include <helper/types.h>
+
+struct target;
+
+extern const struct command_registration memory_cache_command_handlers[];
+
+bool target_memory_cacheable(struct target *target, target_addr_t address, uint32_t size);
+bool target_memory_volatile(struct target *target, target_addr_t address, uint32_t size);
+int target_read_memory_cached(struct target *target,
+		target_addr_t address, uint32_t size, uint8_t *buffer);
+void target_free_memory_cache(struct target *target);
+
+#endif /* OPENOCD_TARGET_MEMORY_CACHE_H */
@@ -53,8 +53,13 @@
 #include "register.h"
 #include "trace.h"
 #include "image.h"
+#include "memory_cache.h"
+#include "benchmark.h"
+#include "adapter_stats_dump.h"
 #include "rtos/rtos.h"
+#include "server/server.h"
 #include "transport/transport.h"
+#include "jtag/adapter_stats.h"
 #include "arm_cti.h"
 #include "smp.h"
 
@@ -871,6 +876,7 @@ int target_run_algorithm(struct target *target,
 			num_reg_params, reg_param,
 			entry_point, exit_point, timeout_ms, arch_info);
 	target->running_alg = false;
+	target_memory_changed(target);
 
 done:
 	return retval;
@@ -911,6 +917,7 @@ int target_start_algorithm(struct target *target,
 	}
 
 	target->running_alg = true;
+	target_memory_changed(target);
 	retval = target->type->start_algorithm(target,
 			num_mem_params, mem_params,
 			num_reg_params, reg_params,
@@ -956,11 +963,24 @@ int target_wait_algorithm(struct target *target,
 			exit_point, timeout_ms, arch_info);
 	if (retval != ERROR_TARGET_TIMEOUT)
 		target->running_alg = false;
+	target_memory_changed(target);
 
 done:
 	return retval;
 }
 
+/* Free space in an async algorithm fifo from wp up to the wrap around or rp */
+static uint32_t async_algorithm_fifo_space(uint32_t rp, uint32_t wp,
+		uint32_t fifo_start_addr, uint32_t fifo_end_addr, int block_size)
+{
+	if (rp > wp)
+		return rp - wp - block_size;
+	else if (rp > fifo_start_addr)
+		return fifo_end_addr - wp;
+	else
+		return fifo_end_addr - wp - block_size;
+}
+
 /**
  * Streams data to a circular buffer on target intended for consumption by code
  * running asynchronously on target.
@@ -1049,37 +1069,39 @@ int target_run_flash_async_algorithm(struct target *target,
 	}
 
 	while (count > 0) {
+		/* Count the number of bytes available in the fifo without
+		 * crossing the wrap around. Make sure to not fill it completely,
+		 * because that would make wp == rp and that's the empty condition.
+		 * The last read pointer we saw can only be behind the real one, so
+		 * as long as it still leaves room there's no need to spend a round
+		 * trip fetching it again; this keeps the link busy with data. */
+		uint32_t thisrun_bytes = async_algorithm_fifo_space(rp, wp,
+				fifo_start_addr, fifo_end_addr, block_size);
 
-		retval = target_read_u32(target, rp_addr, &rp);
-		if (retval != ERROR_OK) {
-			LOG_ERROR("failed to get read pointer");
-			break;
-		}
+		if (thisrun_bytes == 0) {
+			retval = target_read_u32(target, rp_addr, &rp);
+			if (retval != ERROR_OK) {
+				LOG_ERROR("failed to get read pointer");
+				break;
+			}
 
-		LOG_DEBUG("offs 0x%zx count 0x%" PRIx32 " wp 0x%" PRIx32 " rp 0x%" PRIx32,
-			(size_t) (buffer - buffer_orig), count, wp, rp);
+			LOG_DEBUG("offs 0x%zx count 0x%" PRIx32 " wp 0x%" PRIx32 " rp 0x%" PRIx32,
+				(size_t) (buffer - buffer_orig), count, wp, rp);
 
-		if (rp == 0) {
-			LOG_ERROR("flash write algorithm aborted by target");
-			retval = ERROR_FLASH_OPERATION_FAILED;
-			break;
-		}
+			if (rp == 0) {
+				LOG_ERROR("flash write algorithm aborted by target");
+				retval = ERROR_FLASH_OPERATION_FAILED;
+				break;
+			}
 
-		if (!IS_ALIGNED(rp - fifo_start_addr, block_size) || rp < fifo_start_addr || rp >= fifo_end_addr) {
-			LOG_ERROR("corrupted fifo read pointer 0x%" PRIx32, rp);
-			break;
-		}
+			if (!IS_ALIGNED(rp - fifo_start_addr, block_size) || rp < fifo_start_addr || rp >= fifo_end_addr) {
+				LOG_ERROR("corrupted fifo read pointer 0x%" PRIx32, rp);
+				break;
+			}
 
-		/* Count the number of bytes available in the fifo without
-		 * crossing the wrap around. Make sure to not fill it completely,
-		 * because that would make wp == rp and that's the empty condition. */
-		uint32_t thisrun_bytes;
-		if (rp > wp)
-			thisrun_bytes = rp - wp - block_size;
-		else if (rp > fifo_start_addr)
-			thisrun_bytes = fifo_end_addr - wp;
-		else
-			thisrun_bytes = fifo_end_addr - wp - block_size;
+			thisrun_bytes = async_algorithm_fifo_space(rp, wp,
+					fifo_start_addr, fifo_end_addr, block_size);
+		}
 
 		if (thisrun_bytes == 0) {
 			/* Throttle polling a bit if transfer is (much) faster than flash
@@ -1346,6 +1368,7 @@ int target_write_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_memory_changed(target);
 	return target->type->write_memory(target, address, size, count, buffer);
 }
 
@@ -1360,6 +1383,7 @@ int target_write_phys_memory(struct target *target,
 		LOG_ERROR("Target %s doesn't support write_phys_memory", target_name(target));
 		return ERROR_FAIL;
 	}
+	target_memory_changed(target);
 	return target->type->write_phys_memory(target, address, size, count, buffer);
 }
 
@@ -1848,6 +1872,9 @@ int target_call_event_callbacks(struct target *target, enum target_event event)
 			target_event_name(event),
 			target_name(target));
 
+	/* every event marks a change of state that may have touched memory */
+	target_memory_changed(target);
+
 	target_handle_event(target, event);
 
 	while (callback) {
@@ -2271,6 +2298,7 @@ static void target_destroy(struct target *target)
 	}
 
 	target_free_all_working_areas(target);
+	target_free_memory_cache(target);
 
 	/* release the targets SMP list */
 	if (target->smp) {
@@ -2298,6 +2326,8 @@ static void target_destroy(struct target *target)
 
 void target_quit(void)
 {
+	adapter_stats_dump_stop();
+
 	struct target_event_callback *pe = target_event_callbacks;
 	while (pe) {
 		struct target_event_callback *t = pe->next;
@@ -2429,6 +2459,7 @@ int target_write_buffer(struct target *target, target_addr_t address, uint32_t s
 		return ERROR_FAIL;
 	}
 
+	target_memory_changed(target);
 	return target->type->write_buffer(target, address, size, buffer);
 }
 
@@ -3053,7 +3084,9 @@ static int handle_target(void *priv)
 		/* only poll target if we've got power and srst isn't asserted */
 		if (!power_dropout && !srst_asserted) {
 			/* polling may fail silently until the target has been examined */
+			enum adapter_stats_op op = adapter_stats_enter(ADAPTER_STATS_OP_POLL);
 			retval = target_poll(target);
+			adapter_stats_leave(op);
 			if (retval != ERROR_OK) {
 				/* 100ms polling interval. Increase interval between polling up to 5000ms */
 				if (target->backoff.times * polling_interval < 5000) {
@@ -3784,6 +3817,9 @@ COMMAND_HANDLER(handle_dump_image_command)
 
 		size -= this_run_size;
 		address += this_run_size;
+
+		/* don't keep e.g. GDB waiting for the whole dump */
+		server_yield();
 	}
 
 	free(buffer);
@@ -3855,22 +3891,31 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 	int diffs = 0;
 	retval = ERROR_OK;
 	for (unsigned int i = 0; i < image.num_sections; i++) {
-		buffer = malloc(image.sections[i].size);
-		if (!buffer) {
-			command_print(CMD,
-					"error allocating buffer for section (%" PRIu32 " bytes)",
-					image.sections[i].size);
-			break;
-		}
-		retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
-		if (retval != ERROR_OK) {
-			free(buffer);
-			break;
+		const uint8_t *section_data;
+
+		/* use the section contents in place if the image holds them in memory */
+		buffer = NULL;
+		if (image_section_data(&image, i, 0x0, image.sections[i].size, &section_data) == ERROR_OK) {
+			buf_cnt = image.sections[i].size;
+		} else {
+			buffer = malloc(image.sections[i].size);
+			if (!buffer) {
+				command_print(CMD,
+						"error allocating buffer for section (%" PRIu32 " bytes)",
+						image.sections[i].size);
+				break;
+			}
+			retval = image_read_section(&image, i, 0x0, image.sections[i].size, buffer, &buf_cnt);
+			if (retval != ERROR_OK) {
+				free(buffer);
+				break;
+			}
+			section_data = buffer;
 		}
 
 		if (verify >= IMAGE_VERIFY) {
 			/* calculate checksum of image */
-			retval = image_calculate_checksum(buffer, buf_cnt, &checksum);
+			retval = image_calculate_checksum(section_data, buf_cnt, &checksum);
 			if (retval != ERROR_OK) {
 				free(buffer);
 				break;
@@ -3900,13 +3945,13 @@ static COMMAND_HELPER(handle_verify_image_command_internal, enum verify_mode ver
 				if (retval == ERROR_OK) {
 					uint32_t t;
 					for (t = 0; t < buf_cnt; t++) {
-						if (data[t] != buffer[t]) {
+						if (data[t] != section_data[t]) {
 							command_print(CMD,
 										  "diff %d address 0x%08x. Was 0x%02x instead of 0x%02x",
 										  diffs,
 										  (unsigned)(t + image.sections[i].base_address),
 										  data[t],
-										  buffer[t]);
+										  section_data[t]);
 							if (diffs++ >= 127) {
 								command_print(CMD, "More than 128 errors, the rest are not printed.");
 								free(data);
@@ -4317,6 +4362,10 @@ static void write_gmon(uint32_t *samples, uint32_t sample_num, const char *filen
 	fclose(f);
 }
 
+#define PROFILE_SAMPLES_PER_SECOND	100000
+#define PROFILE_MIN_SAMPLES			10000
+#define PROFILE_MAX_SAMPLES			(16 * 1024 * 1024)
+
 /* profiling samples the CPU PC as quickly as OpenOCD is able,
  * which will be used as a random sampling of PC */
 COMMAND_HANDLER(handle_profile_command)
@@ -4326,7 +4375,6 @@ COMMAND_HANDLER(handle_profile_command)
 	if ((CMD_ARGC != 2) && (CMD_ARGC != 4))
 		return ERROR_COMMAND_SYNTAX_ERROR;
 
-	const uint32_t MAX_PROFILE_SAMPLE_NUM = 10000;
 	uint32_t offset;
 	uint32_t num_of_samples;
 	int retval = ERROR_OK;
@@ -4334,6 +4382,15 @@ COMMAND_HANDLER(handle_profile_command)
 
 	COMMAND_PARSE_NUMBER(u32, CMD_ARGV[0], offset);
 
+	/* Size the buffer for the requested duration, so that fast PC samplers
+	 * are not cut short after the first fraction of a second. */
+	uint64_t max_samples = (uint64_t)offset * PROFILE_SAMPLES_PER_SECOND;
+	if (max_samples < PROFILE_MIN_SAMPLES)
+		max_samples = PROFILE_MIN_SAMPLES;
+	if (max_samples > PROFILE_MAX_SAMPLES)
+		max_samples = PROFILE_MAX_SAMPLES;
+	const uint32_t MAX_PROFILE_SAMPLE_NUM = max_samples;
+
 	uint32_t *samples = malloc(sizeof(uint32_t) * MAX_PROFILE_SAMPLE_NUM);
 	if (!samples) {
 		LOG_ERROR("No memory to store samples.");
@@ -4395,6 +4452,13 @@ COMMAND_HANDLER(handle_profile_command)
 		COMMAND_PARSE_NUMBER(u32, CMD_ARGV[3], end_address);
 	}
 
+	if (num_of_samples == 0) {
+		/* write_gmon() needs at least one sample to find the address range */
+		command_print(CMD, "No samples collected, %s not written", CMD_ARGV[1]);
+		free(samples);
+		return ERROR_FAIL;
+	}
+
 	write_gmon(samples, num_of_samples, CMD_ARGV[1],
 		   with_range, start_address, end_address, target, duration_ms);
 	command_print(CMD, "Wrote %s", CMD_ARGV[1]);
@@ -6422,12 +6486,20 @@ static const struct command_registration target_command_handlers[] = {
 		.chain = target_subcommand_handlers,
 		.usage = "",
 	},
+	{
+		.chain = memory_cache_command_handlers,
+	},
 	COMMAND_REGISTRATION_DONE
 };
 
 int target_register_commands(struct command_context *cmd_ctx)
 {
-	return register_commands(cmd_ctx, NULL, target_command_handlers);
+	int retval = register_commands(cmd_ctx, NULL, target_command_handlers);
+	if (retval != ERROR_OK)
+		return retval;
+
+	/* the periodic dump of the adapter statistics needs the target timer */
+	return register_commands(cmd_ctx, "adapter stats", adapter_stats_dump_command_handlers);
 }
 
 static bool target_reset_nag = true;
@@ -6915,6 +6987,9 @@ static const struct command_registration target_exec_command_handlers[] = {
 		.help = "Test the target's memory access functions",
 		.usage = "size",
 	},
+	{
+		.chain = benchmark_command_handlers,
+	},
 
 	COMMAND_REGISTRATION_DONE
 };
@@ -219,6 +219,13 @@ struct target {
 
 	/* The semihosting information, extracted from the target. */
 	struct semihosting *semihosting;
+
+	/* Changed whenever target memory may have been modified, so that
+	 * cached copies of it can tell they are stale. */
+	unsigned int memory_epoch;
+
+	/* memory read cache shared by all clients, see memory_cache.c */
+	struct target_memory_cache *memory_cache;
 };
 
 struct target_list {
@@ -458,6 +465,15 @@ static inline void target_set_examined(struct target *target)
 	target->examined = true;
 }
 
+/**
+ * Note that the memory of @a target may have changed, e.g. because it was
+ * written, the target ran or it was reset. Invalidates any cached copies.
+ */
+static inline void target_memory_changed(struct target *target)
+{
+	target->memory_epoch++;
+}
+
 /**
  * Add the @a breakpoint for @a target.
  *
@@ -0,0 +1,67 @@
+# Throughput benchmark of the adapter bound paths.
+#
+# Runs the benchmark commands against a target and prints the results as
+# a JSON array, one object per benchmark. Run it against the simulated
+# adapter to get numbers that only depend on the OpenOCD build:
+#
+#   openocd -f interface/sim.cfg -f target/hc32l110.cfg \
+#           -c "set BENCHMARK_OUTPUT results.json" -f testing/benchmark.tcl
+#
+# Add "-c {sim latency 1000 100}" before the last -f to model a USB
+# adapter with a 1 ms round trip and 100 ns per transaction.
+#
+# Variables that can be set before sourcing this file:
+#   BENCHMARK_OUTPUT      file to write the JSON to, default: the log
+#   BENCHMARK_RAM         RAM address for the memory benchmarks
+#   BENCHMARK_RAM_SIZE    bytes read and written per iteration
+#   BENCHMARK_FLASH       flash address to program
+#   BENCHMARK_FLASH_SIZE  bytes programmed and verified
+#   BENCHMARK_ITERATIONS  iterations of the memory, register and step benchmarks
+
+proc benchmark_default {name value} {
+	global $name
+	if { ![info exists $name] } {
+		set $name $value
+	}
+}
+
+benchmark_default BENCHMARK_RAM 0x20000000
+benchmark_default BENCHMARK_RAM_SIZE 2048
+benchmark_default BENCHMARK_FLASH 0
+benchmark_default BENCHMARK_FLASH_SIZE 16384
+benchmark_default BENCHMARK_ITERATIONS 20
+
+init
+reset halt
+
+set results {}
+lappend results [benchmark read $BENCHMARK_RAM $BENCHMARK_RAM_SIZE $BENCHMARK_ITERATIONS]
+lappend results [benchmark write $BENCHMARK_RAM $BENCHMARK_RAM_SIZE $BENCHMARK_ITERATIONS]
+lappend results [benchmark regs $BENCHMARK_ITERATIONS]
+lappend results [benchmark step $BENCHMARK_ITERATIONS]
+
+# flash an image with a non-trivial pattern, then verify it
+set image "benchmark.bin"
+set f [open $image w]
+set pattern "OpenOCD benchmark 0123456789abcdefghijklmnopqrstuvwxyz\n"
+set data [string range [string repeat $pattern [expr {$BENCHMARK_FLASH_SIZE / [string length $pattern] + 1}]] \
+	0 [expr {$BENCHMARK_FLASH_SIZE - 1}]]
+puts -nonewline $f $data
+close $f
+
+lappend results [benchmark eval flash_write_image $BENCHMARK_FLASH_SIZE \
+	"flash write_image erase $image $BENCHMARK_FLASH bin"]
+lappend results [benchmark eval verify_image $BENCHMARK_FLASH_SIZE \
+	"verify_image $image $BENCHMARK_FLASH bin"]
+file delete $image
+
+set json "\[\n  [join $results ",\n  "]\n\]\n"
+if { [info exists BENCHMARK_OUTPUT] } {
+	set f [open $BENCHMARK_OUTPUT w]
+	puts -nonewline $f $json
+	close $f
+} else {
+	echo $json
+}
+
+shutdown
@@ -0,0 +1,57 @@
+# Check of "flash write_image incremental" with an image that ends in the
+# middle of a sector: the rest of that sector must keep its contents.
+#
+#   openocd -f interface/sim.cfg -f target/hc32l110.cfg -f testing/incremental.tcl
+#
+# Variables that can be set before sourcing this file:
+#   INCREMENTAL_FLASH        flash address to use, must start a sector
+#   INCREMENTAL_SECTOR_SIZE  size of the sector at that address
+#   INCREMENTAL_IMAGE_SIZE   bytes in the image, less than a sector
+
+proc incremental_default {name value} {
+	global $name
+	if { ![info exists $name] } {
+		set $name $value
+	}
+}
+
+incremental_default INCREMENTAL_FLASH 0
+incremental_default INCREMENTAL_SECTOR_SIZE 512
+incremental_default INCREMENTAL_IMAGE_SIZE 100
+
+init
+reset halt
+
+# known contents for the whole sector
+flash erase_address $INCREMENTAL_FLASH $INCREMENTAL_SECTOR_SIZE
+flash fillw $INCREMENTAL_FLASH 0x5a5a5a5a [expr {$INCREMENTAL_SECTOR_SIZE / 4}]
+
+set image "incremental.bin"
+set f [open $image w]
+puts -nonewline $f [string repeat "A" $INCREMENTAL_IMAGE_SIZE]
+close $f
+
+flash write_image incremental $image $INCREMENTAL_FLASH bin
+file delete $image
+
+set words [expr {$INCREMENTAL_SECTOR_SIZE / 4}]
+mem2array sector 32 $INCREMENTAL_FLASH $words
+set failed 0
+for {set i 0} {$i < $words} {incr i} {
+	if { $i < $INCREMENTAL_IMAGE_SIZE / 4 } {
+		set expected 0x41414141
+	} else {
+		set expected 0x5a5a5a5a
+	}
+	if { $sector($i) != $expected } {
+		echo [format "FAIL: word at 0x%08x is 0x%08x, expected 0x%08x" \
+			[expr {$INCREMENTAL_FLASH + 4 * $i}] $sector($i) $expected]
+		set failed 1
+	}
+}
+
+if { $failed } {
+	shutdown error
+}
+echo "PASS: rest of the sector kept its contents"
+shutdown